@@ -0,0 +1,637 @@
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <sys/resource.h>
+#include "render.h"
+#include "mosaic.h"
+#include "catalog.h"
+#include "pyramid.h"
+#include "priority.h"
+
+// Benchmark of the wallpaper pipeline over a synthetic, seeded corpus.
+// Each Scaling x Gravity x multiply x target combination emits one JSON
+// object per line so runs from different commits can be diffed directly.
+//
+// With --compare every image is rendered by convert and by the in-process
+// renderer, and the two are checked against each other as well as timed.
+// --lut-check tests the renderer's 16-bit linear-light tables against the
+// floating point sRGB curves.  --mosaic times collages of that many tiles
+// drawn from the corpus instead, and --kernels times the specialised
+// composite kernels against the generic QPainter composite.
+
+static const quint32 defaultSeed = 314;
+static const int defaultImages = 9;
+static const QSize corpusSizes[] = {
+    { 640, 480 }, { 800, 600 }, { 1280, 720 }, { 1920, 1200 },
+    { 2560, 1440 }, { 3840, 2160 }, { 5472, 3648 }, { 7680, 4320 },
+    { 12000, 8000 }
+};
+static const QSize targetSizes[] = {
+    { 1920, 1080 }, { 2560, 1440 }, { 3840, 2160 }
+};
+static const char *corpusFormats[] = { "jpg", "png", "gif" };
+// The collage --mosaic always times, and how long it may take.
+static const QSize mosaicBudgetTarget(3840, 2160);
+static const int mosaicBudgetTiles = 24;
+static const int mosaicBudgetMs = 750;
+// How far native output may be from convert's, by scale mode.  Unscaled
+// modes differ only by rounding; scaled ones resample with our own filter
+// tables, which land a level or two off convert's along sharp edges.
+struct Tolerance {
+    int maxDelta;
+    double minPsnr;
+    const char *reason;
+};
+static const Tolerance tolerances[] = {
+    { 3, 40.0, "resampled: filter taps round differently along edges" },
+    { 3, 40.0, "resampled: filter taps round differently along edges" },
+    { 1, 50.0, "unscaled: rounding only" },
+    { 1, 50.0, "unscaled: rounding only" }
+};
+static const double identicalPsnr = 99.0;
+// the kernels round like QPainter, up to its premultiply
+static const int kernelMaxDelta = 1;
+
+enum Engine { ConvertEngine, NativeEngine };
+static const char *engineNames[] = { "convert", "native" };
+// levels made while rendering, inside the scratch folder
+static const char pyramidFolderName[] = "pyramid";
+
+struct CorpusImage {
+    QString file;
+    QSize size;
+    QString format;
+    bool alpha;
+};
+
+struct Difference {
+    int maxDelta;
+    double psnr;
+};
+
+struct Usage {
+    qint64 cpuUsec;
+    long peakRssKb;
+};
+
+static qint64 toUsec(const timeval &tv)
+{
+    return qint64(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+// Resources used by us and by every convert we have waited on so far.
+static Usage usage()
+{
+    rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    Usage u;
+    u.cpuUsec = toUsec(self.ru_utime) + toUsec(self.ru_stime)
+            + toUsec(children.ru_utime) + toUsec(children.ru_stime);
+    u.peakRssKb = std::max(self.ru_maxrss, children.ru_maxrss);
+    return u;
+}
+
+static void paintImage(QImage &img, bool alpha, std::mt19937 &rgen)
+{
+    std::uniform_int_distribution<int> channel(0, 255);
+    std::uniform_real_distribution<qreal> unit(0.0, 1.0);
+    auto randomColor = [&](int a) {
+        return QColor(channel(rgen), channel(rgen), channel(rgen), a);
+    };
+
+    QPainter p(&img);
+    p.setRenderHint(QPainter::Antialiasing);
+    if (alpha) {
+        img.fill(Qt::transparent);
+    } else {
+        QLinearGradient g(0, 0, img.width(), img.height());
+        g.setColorAt(0, randomColor(255));
+        g.setColorAt(1, randomColor(255));
+        p.fillRect(img.rect(), g);
+    }
+    p.setPen(Qt::NoPen);
+    for (int i = 0; i < 48; i++) {
+        QRectF r(unit(rgen) * img.width(), unit(rgen) * img.height(),
+                 unit(rgen) * img.width() / 2, unit(rgen) * img.height() / 2);
+        p.setBrush(randomColor(alpha ? channel(rgen) : 255));
+        if (i & 1)
+            p.drawEllipse(r);
+        else
+            p.drawRect(r);
+    }
+}
+
+static bool saveImage(const QImage &img, const QString &file,
+                      const QString &format)
+{
+    if (format != "gif")
+        return img.save(file, nullptr, 90);
+
+    // Qt has no gif writer, so let imagemagick do it
+    QString png = file + ".png";
+    if (!img.save(png))
+        return false;
+    int exitCode = QProcess::execute("convert", QStringList() << png << file);
+    QFile::remove(png);
+    return exitCode == 0;
+}
+
+static QList<CorpusImage> makeCorpus(const QString &folder, quint32 seed,
+                                     int count, bool quick)
+{
+    QList<CorpusImage> corpus;
+    std::mt19937 rgen(seed);
+    int sizeCount = int(sizeof(corpusSizes) / sizeof(corpusSizes[0]));
+    if (quick)
+        sizeCount = 6;
+    std::uniform_int_distribution<int> sizeDist(0, sizeCount - 1);
+    std::uniform_int_distribution<int> coin(0, 1);
+
+    for (int i = 0; i < count; i++) {
+        CorpusImage c;
+        // every size in the range shows up before any repeats
+        c.size = corpusSizes[i < sizeCount ? i : sizeDist(rgen)];
+        c.format = corpusFormats[i % 3];
+        c.alpha = c.format != "jpg" && coin(rgen);
+        c.file = QString("%1/s%2-%3-%4x%5%6.%7").arg(folder).arg(seed).arg(i)
+                .arg(c.size.width()).arg(c.size.height())
+                .arg(c.alpha ? "a" : "").arg(c.format);
+        // the image itself draws from its own stream, so cached files and
+        // fresh ones agree regardless of which were skipped
+        std::mt19937 imageGen(seed + i);
+        if (!QFileInfo::exists(c.file)) {
+            QImage img(c.size, c.alpha ? QImage::Format_ARGB32
+                                       : QImage::Format_RGB32);
+            paintImage(img, c.alpha, imageGen);
+            if (!saveImage(img, c.file, c.format)) {
+                QTextStream(stderr) << "could not write " << c.file << "\n";
+                continue;
+            }
+        }
+        corpus.append(c);
+    }
+    return corpus;
+}
+
+// Render one image the way Flow::changeOneWall and
+// Flow::changeWallConvertFinished do: render, then publish by copying.
+// Each run starts from nothing known and nothing kept, as the first
+// showing of an image does, so results do not depend on the order.
+static bool runPipeline(Engine engine, const QString &srcfname,
+                        const QString &workFolder, const Render::Params &p)
+{
+    static Render::Engine renderer;
+    // the smaller pyramid levels of the last run are still being made
+    Priority::waitForDone();
+    renderer.clear();
+    Catalog::instance()->clear();
+    QDir(workFolder + "/" + pyramidFolderName).removeRecursively();
+
+    QString temp = workFolder + "/tempimage.png";
+    QString published = workFolder + "/published.png";
+    if (engine == NativeEngine) {
+        // the app's own path: pyramid levels, region decodes and all
+        QImage wall = renderer.render(srcfname, p);
+        if (wall.isNull() || !wall.save(temp))
+            return false;
+    } else {
+        QProcess converter;
+        converter.setEnvironment(QProcess::systemEnvironment()
+                                 << "MAGICK_OCL_DEVICE=OFF");
+        // the app finds the focus on its render thread first
+        if (p.scale == ScaledCropped && p.weight == Automatic)
+            Catalog::instance()->cropFocus(srcfname);
+        converter.start("convert", Render::convertArguments(srcfname, temp, p));
+        if (!converter.waitForFinished(-1) || converter.exitCode())
+            return false;
+    }
+    QFile::remove(published);
+    bool ok = QFile::copy(temp, published);
+    QFile::remove(temp);
+    return ok;
+}
+
+static Difference compareImages(const QImage &expected, const QImage &actual)
+{
+    Difference d = { 255, 0.0 };
+    if (expected.size() != actual.size() || expected.isNull())
+        return d;
+    QImage a = expected.convertToFormat(QImage::Format_RGB32);
+    QImage b = actual.convertToFormat(QImage::Format_RGB32);
+    d.maxDelta = 0;
+    double sumSquares = 0;
+    for (int y = 0; y < a.height(); y++) {
+        const QRgb *la = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+        const QRgb *lb = reinterpret_cast<const QRgb*>(b.constScanLine(y));
+        for (int x = 0; x < a.width(); x++) {
+            int dr = qRed(la[x]) - qRed(lb[x]);
+            int dg = qGreen(la[x]) - qGreen(lb[x]);
+            int db = qBlue(la[x]) - qBlue(lb[x]);
+            d.maxDelta = std::max(d.maxDelta, std::max(std::abs(dr),
+                                  std::max(std::abs(dg), std::abs(db))));
+            sumSquares += dr*dr + dg*dg + db*db;
+        }
+    }
+    double mse = sumSquares / (3.0 * a.width() * a.height());
+    d.psnr = mse > 0 ? std::min(identicalPsnr, 10 * std::log10(255.0*255.0 / mse))
+                     : identicalPsnr;
+    return d;
+}
+
+static double srgbToLinearExact(double c)
+{
+    return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+}
+
+static double linearToSrgbExact(double l)
+{
+    return l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1 / 2.4) - 0.055;
+}
+
+// Halve an image by averaging 2x2 blocks in floating point linear light,
+// which is what Qt's area scaler does at exactly half size.
+static QImage halveExact(const QImage &image)
+{
+    QImage src = image.convertToFormat(QImage::Format_RGB32);
+    QImage half(src.width() / 2, src.height() / 2, QImage::Format_RGB32);
+    for (int y = 0; y < half.height(); y++) {
+        QRgb *out = reinterpret_cast<QRgb*>(half.scanLine(y));
+        for (int x = 0; x < half.width(); x++) {
+            double sum[3] = { 0, 0, 0 };
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    QRgb px = src.pixel(2*x + dx, 2*y + dy);
+                    sum[0] += srgbToLinearExact(qRed(px) / 255.0);
+                    sum[1] += srgbToLinearExact(qGreen(px) / 255.0);
+                    sum[2] += srgbToLinearExact(qBlue(px) / 255.0);
+                }
+            }
+            out[x] = qRgb(int(std::lround(linearToSrgbExact(sum[0] / 4) * 255)),
+                          int(std::lround(linearToSrgbExact(sum[1] / 4) * 255)),
+                          int(std::lround(linearToSrgbExact(sum[2] / 4) * 255)));
+        }
+    }
+    return half;
+}
+
+static bool lutCheck(const QList<CorpusImage> &corpus, QFile &out)
+{
+    int roundtripErrors = 0;
+    double toLinearError = 0, toSrgbError = 0;
+    for (int v = 0; v < 256; v++) {
+        quint16 l = Render::srgbToLinear(quint8(v));
+        if (Render::linearToSrgb(l) != v)
+            roundtripErrors++;
+        toLinearError = std::max(toLinearError,
+                                 std::abs(l - srgbToLinearExact(v / 255.0) * 65535));
+    }
+    for (int l = 0; l < 65536; l++)
+        toSrgbError = std::max(toSrgbError,
+                               std::abs(Render::linearToSrgb(quint16(l))
+                                        - linearToSrgbExact(l / 65535.0) * 255));
+
+    int resampleDelta = 0;
+    for (const CorpusImage &c : corpus) {
+        QImage source(c.file);
+        if (source.hasAlphaChannel() || source.width() > 3840)
+            continue;
+        source = source.copy(0, 0, source.width() & ~1, source.height() & ~1);
+        QSize half = source.size() / 2;
+        // Qt's area scaler is an exact box at half size, which isolates the
+        // table error from the choice of kernel
+        QImage linear = Render::toLinear(source).scaled(half, Qt::IgnoreAspectRatio,
+                                                       Qt::SmoothTransformation);
+        Difference d = compareImages(halveExact(source),
+                                     Render::fromLinear(linear, QImage::Format_RGB32));
+        resampleDelta = std::max(resampleDelta, d.maxDelta);
+    }
+
+    bool pass = roundtripErrors == 0 && toLinearError <= 0.5
+            && toSrgbError <= 0.5 && resampleDelta <= 1;
+    QJsonObject o;
+    o["check"] = "lut";
+    o["roundtrip_errors"] = roundtripErrors;
+    o["to_linear_max_error"] = toLinearError;
+    o["to_srgb_max_error"] = toSrgbError;
+    o["resample_max_delta"] = resampleDelta;
+    o["pass"] = pass;
+    out.write(QJsonDocument(o).toJson(QJsonDocument::Compact));
+    out.write("\n");
+    return pass;
+}
+
+// One line per collage of tiles corpus images, cycling through the corpus
+// when it has fewer.  budgetMs > 0 makes the time count toward the pass.
+static bool timeMosaic(const QList<CorpusImage> &corpus, const QSize &target,
+                       int tiles, int budgetMs, QFile &out)
+{
+    QStringList files;
+    for (int i = 0; i < tiles; i++)
+        files << corpus[i % corpus.count()].file;
+    Render::Params p;
+    p.target = target;
+    p.scale = Mosaic;
+    p.tiles = tiles;
+    // the first run also fills the catalog
+    Render::renderMosaic(files, p);
+    Usage before = usage();
+    QElapsedTimer timer;
+    timer.start();
+    QImage wall = Render::renderMosaic(files, p);
+    qint64 wallUsec = timer.nsecsElapsed() / 1000;
+    Usage after = usage();
+
+    bool pass = !wall.isNull()
+                && (budgetMs <= 0 || wallUsec <= budgetMs * 1000LL);
+    QJsonObject o;
+    o["target"] = p.targetString();
+    o["scale"] = int(Mosaic);
+    o["tiles"] = tiles;
+    // tiles are decoded on Priority's idle pool, not the global one
+    o["threads"] = Priority::threadCount();
+    o["wall_ms"] = wallUsec / 1000.0;
+    o["cpu_ms"] = (after.cpuUsec - before.cpuUsec) / 1000.0;
+    o["peak_rss_kb"] = qint64(after.peakRssKb);
+    if (budgetMs > 0)
+        o["budget_ms"] = budgetMs;
+    o["pass"] = pass;
+    out.write(QJsonDocument(o).toJson(QJsonDocument::Compact));
+    out.write("\n");
+    out.flush();
+    return pass;
+}
+
+// Each target at the given tile count, then the collage the feature is
+// held to: 24 tiles at 4K well under a second.
+static bool mosaicBench(const QList<CorpusImage> &corpus, int tiles,
+                        QFile &out)
+{
+    bool pass = true;
+    for (const QSize &target : targetSizes)
+        pass &= timeMosaic(corpus, target, tiles, 0, out);
+    pass &= timeMosaic(corpus, mosaicBudgetTarget, mosaicBudgetTiles,
+                       mosaicBudgetMs, out);
+    return pass;
+}
+
+// One line per target, scale and multiply: both composites over the
+// corpus, placed at the centre.
+static bool kernelBench(const QList<CorpusImage> &corpus, QFile &out)
+{
+    bool allPass = true;
+    for (const QSize &target : targetSizes) {
+        for (int scale = ScaledProportions; scale <= NotScaled; scale++) {
+            for (bool multiply : { false, true }) {
+                Render::Params p;
+                p.target = target;
+                p.scale = Scaling(scale);
+                p.weight = Center;
+                p.multiply = multiply;
+
+                qint64 genericUsec = 0, kernelUsec = 0, plainUsec = 0;
+                int maxDelta = 0, alpha = 0;
+                QElapsedTimer timer;
+                for (const CorpusImage &c : corpus) {
+                    Render::Layer layer = Render::placeLayer(
+                                Render::loadImage(c.file), p);
+                    alpha += layer.image.hasAlphaChannel();
+                    timer.start();
+                    QImage expected = Render::compositeGeneric(layer, p);
+                    genericUsec += timer.nsecsElapsed() / 1000;
+                    timer.start();
+                    QImage actual = Render::composite(layer, p);
+                    kernelUsec += timer.nsecsElapsed() / 1000;
+                    // what previews, composited without dither, save
+                    timer.start();
+                    Render::composite(layer, p, false);
+                    plainUsec += timer.nsecsElapsed() / 1000;
+                    maxDelta = std::max(maxDelta,
+                                        compareImages(expected, actual).maxDelta);
+                }
+                bool pass = maxDelta <= kernelMaxDelta;
+                allPass = allPass && pass;
+
+                QJsonObject o;
+                o["target"] = p.targetString();
+                o["scale"] = scale;
+                o["multiply"] = multiply;
+                o["images"] = corpus.count();
+                o["alpha_images"] = alpha;
+                o["generic_ms"] = genericUsec / 1000.0;
+                o["kernel_ms"] = kernelUsec / 1000.0;
+                o["speedup"] = kernelUsec ? double(genericUsec) / kernelUsec : 0.0;
+                o["undithered_ms"] = plainUsec / 1000.0;
+                o["max_delta"] = maxDelta;
+                o["pass"] = pass;
+                out.write(QJsonDocument(o).toJson(QJsonDocument::Compact));
+                out.write("\n");
+                out.flush();
+            }
+        }
+    }
+    return allPass;
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("qt314wall render benchmark");
+    parser.addHelpOption();
+    QCommandLineOption seedOption("seed", "Corpus seed.", "n",
+                                  QString::number(defaultSeed));
+    QCommandLineOption imagesOption("images", "Corpus size.", "n",
+                                    QString::number(defaultImages));
+    QCommandLineOption corpusOption("corpus",
+                                    "Keep the corpus in this folder.", "dir");
+    QCommandLineOption quickOption("quick",
+                                   "Two gravities and sources up to 4K only.");
+    QCommandLineOption outputOption("output",
+                                    "Write results here instead of stdout.",
+                                    "file");
+    QCommandLineOption engineOption("engine", "convert or native.", "name",
+                                    engineNames[ConvertEngine]);
+    QCommandLineOption compareOption("compare",
+                                     "Check native against convert output.");
+    QCommandLineOption maxDeltaOption("max-delta",
+                                      "Largest channel difference allowed "
+                                      "(default: 1 unscaled, 3 scaled).",
+                                      "n");
+    QCommandLineOption minPsnrOption("min-psnr", "Lowest PSNR allowed "
+                                     "(default: 50 unscaled, 40 scaled).", "dB");
+    QCommandLineOption filterOption("filter",
+                                    "auto, bilinear, mitchell or lanczos3.",
+                                    "name", dialogdata::filterStrings[AutomaticFilter]);
+    QCommandLineOption lutCheckOption("lut-check",
+                                      "Check the linear-light tables and exit.");
+    QCommandLineOption mosaicOption("mosaic", "Time collages of n tiles.", "n");
+    QCommandLineOption kernelsOption("kernels",
+                                     "Time composite kernels against QPainter.");
+    parser.addOptions({ seedOption, imagesOption, corpusOption, quickOption,
+                        outputOption, engineOption, compareOption,
+                        maxDeltaOption, minPsnrOption, filterOption,
+                        lutCheckOption, mosaicOption, kernelsOption });
+    parser.process(a);
+
+    quint32 seed = parser.value(seedOption).toUInt();
+    bool quick = parser.isSet(quickOption);
+    bool compare = parser.isSet(compareOption);
+    Engine engine = parser.value(engineOption) == engineNames[NativeEngine]
+            ? NativeEngine : ConvertEngine;
+    bool fixedDelta = parser.isSet(maxDeltaOption);
+    bool fixedPsnr = parser.isSet(minPsnrOption);
+    int maxDelta = parser.value(maxDeltaOption).toInt();
+    double minPsnr = parser.value(minPsnrOption).toDouble();
+    int failedCombinations = 0;
+    Filter filter = AutomaticFilter;
+    for (int f = AutomaticFilter; f <= Lanczos3; f++)
+        if (parser.value(filterOption) == dialogdata::filterStrings[f])
+            filter = Filter(f);
+
+    QTemporaryDir scratch(QDir("/dev/shm").exists()
+                          ? "/dev/shm/qt314wall-bench-XXXXXX"
+                          : QDir::tempPath() + "/qt314wall-bench-XXXXXX");
+    QString corpusFolder = parser.value(corpusOption);
+    if (corpusFolder.isEmpty())
+        corpusFolder = scratch.path() + "/corpus";
+    QDir().mkpath(corpusFolder);
+    Pyramid::setFolder(scratch.path() + "/" + pyramidFolderName);
+
+    QFile out;
+    if (parser.isSet(outputOption)) {
+        out.setFileName(parser.value(outputOption));
+        out.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text);
+    } else {
+        out.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+
+    QList<CorpusImage> corpus = makeCorpus(corpusFolder, seed,
+                                           parser.value(imagesOption).toInt(),
+                                           quick);
+    if (corpus.isEmpty())
+        return 1;
+    if (parser.isSet(lutCheckOption))
+        return lutCheck(corpus, out) ? 0 : 2;
+    if (parser.isSet(kernelsOption))
+        return kernelBench(corpus, out) ? 0 : 2;
+    if (parser.isSet(mosaicOption)) {
+        int tiles = std::max(1, parser.value(mosaicOption).toInt());
+        return mosaicBench(corpus, tiles, out) ? 0 : 2;
+    }
+
+    QList<Gravity> gravities;
+    if (quick)
+        gravities << NorthWest << Center;
+    else
+        for (int g = North; g <= Automatic; g++)
+            gravities << Gravity(g);
+
+    for (const QSize &target : targetSizes) {
+        for (int scale = ScaledProportions; scale <= NotScaled; scale++) {
+            for (Gravity weight : gravities) {
+                for (bool multiply : { false, true }) {
+                    Render::Params p;
+                    p.target = target;
+                    p.scale = Scaling(scale);
+                    p.weight = weight;
+                    p.multiply = multiply;
+                    p.filter = filter;
+
+                    QJsonObject o;
+                    o["seed"] = qint64(seed);
+                    o["target"] = p.targetString();
+                    o["scale"] = scale;
+                    o["gravity"] = dialogdata::gravityStrings[weight];
+                    o["multiply"] = multiply;
+                    o["filter"] = dialogdata::filterStrings[filter];
+
+                    int rendered = 0;
+                    QElapsedTimer timer;
+                    if (compare) {
+                        qint64 convertUsec = 0, nativeUsec = 0;
+                        Difference worst = { 0, identicalPsnr };
+                        for (const CorpusImage &c : corpus) {
+                            timer.start();
+                            bool ok = runPipeline(ConvertEngine, c.file,
+                                                  scratch.path(), p);
+                            convertUsec += timer.nsecsElapsed() / 1000;
+                            QImage expected(scratch.path() + "/published.png");
+                            timer.start();
+                            ok = runPipeline(NativeEngine, c.file,
+                                             scratch.path(), p) && ok;
+                            nativeUsec += timer.nsecsElapsed() / 1000;
+                            QImage actual(scratch.path() + "/published.png");
+                            if (!ok)
+                                continue;
+                            Difference d = compareImages(expected, actual);
+                            worst.maxDelta = std::max(worst.maxDelta, d.maxDelta);
+                            worst.psnr = std::min(worst.psnr, d.psnr);
+                            rendered++;
+                        }
+                        const Tolerance &t = tolerances[scale];
+                        int allowedDelta = fixedDelta ? maxDelta : t.maxDelta;
+                        double allowedPsnr = fixedPsnr ? minPsnr : t.minPsnr;
+                        bool pass = rendered == corpus.count()
+                                && worst.maxDelta <= allowedDelta
+                                && worst.psnr >= allowedPsnr;
+                        if (!pass)
+                            failedCombinations++;
+                        o["engine"] = "compare";
+                        o["images"] = rendered;
+                        o["failed"] = corpus.count() - rendered;
+                        o["convert_ms"] = convertUsec / 1000.0;
+                        o["native_ms"] = nativeUsec / 1000.0;
+                        o["speedup"] = nativeUsec ? double(convertUsec) / nativeUsec
+                                                  : 0.0;
+                        o["max_delta"] = worst.maxDelta;
+                        o["psnr"] = worst.psnr;
+                        o["allowed_delta"] = allowedDelta;
+                        o["allowed_psnr"] = allowedPsnr;
+                        o["tolerance"] = fixedDelta || fixedPsnr
+                                ? "command line" : t.reason;
+                        o["pass"] = pass;
+                    } else {
+                        Usage before = usage();
+                        timer.start();
+                        for (const CorpusImage &c : corpus)
+                            if (runPipeline(engine, c.file, scratch.path(), p))
+                                rendered++;
+                        qint64 wallUsec = timer.nsecsElapsed() / 1000;
+                        Usage after = usage();
+
+                        o["engine"] = engineNames[engine];
+                        o["images"] = rendered;
+                        o["failed"] = corpus.count() - rendered;
+                        o["wall_ms"] = wallUsec / 1000.0;
+                        o["cpu_ms"] = (after.cpuUsec - before.cpuUsec) / 1000.0;
+                        o["peak_rss_kb"] = qint64(after.peakRssKb);
+                        o["images_per_sec"] = wallUsec ? rendered * 1e6 / wallUsec
+                                                       : 0.0;
+                    }
+                    out.write(QJsonDocument(o).toJson(QJsonDocument::Compact));
+                    out.write("\n");
+                    out.flush();
+                }
+            }
+        }
+    }
+    return failedCombinations ? 2 : 0;
+}
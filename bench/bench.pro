@@ -0,0 +1,37 @@
+#-------------------------------------------------
+#
+# Render benchmark, built from the top level with `make bench`
+#
+#-------------------------------------------------
+
+QT       += core gui concurrent
+
+TARGET = qt314wall-bench
+TEMPLATE = app
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += bench.cpp \
+    ../dialogdata.cpp \
+    ../render.cpp \
+    ../framepool.cpp \
+    ../metrics.cpp \
+    ../resample.cpp \
+    ../priority.cpp \
+    ../mosaic.cpp \
+    ../catalog.cpp \
+    ../pathstore.cpp \
+    ../pyramid.cpp
+
+HEADERS  += ../dialogdata.h \
+    ../render.h \
+    ../framepool.h \
+    ../metrics.h \
+    ../resample.h \
+    ../priority.h \
+    ../mosaic.h \
+    ../catalog.h \
+    ../pathstore.h \
+    ../pyramid.h
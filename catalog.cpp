@@ -0,0 +1,292 @@
+#include "catalog.h"
+#include "metrics.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QtAlgorithms>
+
+static const quint32 catalogMagic = 0x33313463;     // "c413"
+// 2 added hashes, 3 crop focus; older ones are still read
+static const quint32 catalogVersion = 3;
+static const int hashBands = 8;
+// hashes are taken from a decode this size, which jpeg makes almost free
+static const int hashDecodeSide = 64;
+static const int focusScale = 10000;
+// edge energy at the corners counts this much less than in the middle
+static const double centreBias = 1.0;
+
+Catalog *Catalog::instance()
+{
+    static Catalog catalog;
+    return &catalog;
+}
+
+Catalog::Catalog() : dirty(false)
+{
+
+}
+
+bool Catalog::matches(const Entry &entry, const QFileInfo &info)
+{
+    return entry.bytes == info.size()
+            && entry.modified == info.lastModified().toMSecsSinceEpoch();
+}
+
+QSize Catalog::imageSize(const QString &fname)
+{
+    QFileInfo info(fname);
+    {
+        QMutexLocker lock(&mutex);
+        auto it = entries.constFind(fname);
+        if (it != entries.constEnd() && matches(*it, info)) {
+            Metrics::add("catalog/hits");
+            return it->size;
+        }
+    }
+    // only the header is read
+    QSize size = QImageReader(fname).size();
+    Metrics::add("catalog/misses");
+    if (!size.isValid())
+        return size;
+    QMutexLocker lock(&mutex);
+    // a changed file is hashed again
+    unindexHash(fname, entries.value(fname).hash);
+    entries.insert(fname, Entry { info.lastModified().toMSecsSinceEpoch(),
+                                  info.size(), size, 0, -1, -1 });
+    dirty = true;
+    return size;
+}
+
+quint64 Catalog::knownHash(const QString &fname)
+{
+    QFileInfo info(fname);
+    QMutexLocker lock(&mutex);
+    auto it = entries.constFind(fname);
+    return it != entries.constEnd() && matches(*it, info) ? it->hash : 0;
+}
+
+quint64 Catalog::imageHash(const QString &fname)
+{
+    // catalogs from before the focus get it on the next pass
+    quint64 hash = knownHash(fname);
+    QPointF focus;
+    if ((!hash || !knownFocus(fname, &focus)) && analyse(fname))
+        hash = knownHash(fname);
+    return hash;
+}
+
+bool Catalog::knownFocus(const QString &fname, QPointF *focus)
+{
+    QFileInfo info(fname);
+    QMutexLocker lock(&mutex);
+    auto it = entries.constFind(fname);
+    if (it == entries.constEnd() || !matches(*it, info) || it->focusX < 0)
+        return false;
+    *focus = QPointF(double(it->focusX) / focusScale,
+                     double(it->focusY) / focusScale);
+    return true;
+}
+
+QPointF Catalog::cropFocus(const QString &fname)
+{
+    QPointF focus;
+    if (knownFocus(fname, &focus)
+            || (analyse(fname) && knownFocus(fname, &focus)))
+        return focus;
+    return QPointF(0.5, 0.5);
+}
+
+bool Catalog::analyse(const QString &fname)
+{
+    QImageReader reader(fname);
+    QSize size = reader.size();
+    if (!size.isValid())
+        return false;
+    reader.setScaledSize(size.boundedTo(QSize(hashDecodeSide, hashDecodeSide)));
+    QImage image;
+    if (!reader.read(&image))
+        return false;
+    quint64 hash = hashImage(image);
+    QPointF focus = saliencyFocus(image);
+    Metrics::add("catalog/hashed");
+
+    QFileInfo info(fname);
+    QMutexLocker lock(&mutex);
+    Entry &e = entries[fname];
+    // re-analysed entries keep their place in the bands if the hash held
+    if (e.hash != hash) {
+        unindexHash(fname, e.hash);
+        indexHash(fname, hash);
+    }
+    e = Entry { info.lastModified().toMSecsSinceEpoch(), info.size(), size, hash,
+                qint16(qRound(focus.x() * focusScale)),
+                qint16(qRound(focus.y() * focusScale)) };
+    dirty = true;
+    return true;
+}
+
+QString Catalog::findNear(quint64 hash, const QString &except)
+{
+    if (!hash)
+        return QString();
+    // bands only change under the mutex, with unindexHash dropping a name
+    // as its hash is replaced, so the range stays valid while we hold it
+    QMutexLocker lock(&mutex);
+    for (int band = 0; band < hashBands; band++) {
+        auto range = bands.equal_range(bandKey(hash, band));
+        for (auto it = range.first; it != range.second; ++it) {
+            // sharing a band is only 8 bits: compare the whole hash
+            auto entry = entries.constFind(*it);
+            if (*it != except && entry != entries.constEnd()
+                    && entry->hash && distance(entry->hash, hash) <= nearBits)
+                return *it;
+        }
+    }
+    return QString();
+}
+
+bool Catalog::hasHashes()
+{
+    QMutexLocker lock(&mutex);
+    return !bands.isEmpty();
+}
+
+quint64 Catalog::hashImage(const QImage &image)
+{
+    // 9x8 grey, then one bit per neighbour pair: is the right one brighter
+    QImage grey = image.convertToFormat(QImage::Format_Grayscale8)
+            .scaled(9, 8, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    quint64 hash = 0;
+    for (int y = 0; y < 8; y++) {
+        const uchar *row = grey.constScanLine(y);
+        for (int x = 0; x < 8; x++)
+            hash = hash << 1 | (row[x] < row[x + 1]);
+    }
+    return hash;
+}
+
+QPointF Catalog::saliencyFocus(const QImage &image)
+{
+    // central differences of the grey image, squared so that strong detail
+    // outweighs texture and noise, and leaning a little to the middle
+    QImage grey = image.convertToFormat(QImage::Format_Grayscale8);
+    int w = grey.width(), h = grey.height();
+    double total = 0, sumX = 0, sumY = 0;
+    for (int y = 1; y < h - 1; y++) {
+        const uchar *above = grey.constScanLine(y - 1);
+        const uchar *row = grey.constScanLine(y);
+        const uchar *below = grey.constScanLine(y + 1);
+        double dy = (y + 0.5) / h - 0.5;
+        for (int x = 1; x < w - 1; x++) {
+            int edge = qAbs(row[x + 1] - row[x - 1]) + qAbs(below[x] - above[x]);
+            double dx = (x + 0.5) / w - 0.5;
+            double energy = double(edge * edge)
+                    * (1.0 - centreBias * (dx * dx + dy * dy));
+            total += energy;
+            sumX += energy * (x + 0.5);
+            sumY += energy * (y + 0.5);
+        }
+    }
+    // flat or tiny images have no subject to speak of
+    if (total <= 0)
+        return QPointF(0.5, 0.5);
+    return QPointF(sumX / total / w, sumY / total / h);
+}
+
+int Catalog::distance(quint64 a, quint64 b)
+{
+    return int(qPopulationCount(a ^ b));
+}
+
+quint32 Catalog::bandKey(quint64 hash, int band)
+{
+    return quint32(band) << 24 | (quint32(hash >> (band * 8)) & 0xff);
+}
+
+void Catalog::indexHash(const QString &fname, quint64 hash)
+{
+    for (int band = 0; band < hashBands; band++)
+        bands.insert(bandKey(hash, band), fname);
+}
+
+void Catalog::unindexHash(const QString &fname, quint64 hash)
+{
+    if (!hash)
+        return;
+    for (int band = 0; band < hashBands; band++)
+        bands.remove(bandKey(hash, band), fname);
+}
+
+void Catalog::load(const QString &fileName)
+{
+    QMutexLocker lock(&mutex);
+    this->fileName = fileName;
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly))
+        return;
+    QDataStream in(&f);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != catalogMagic || version < 1 || version > catalogVersion)
+        return;
+    quint32 count;
+    in >> count;
+    entries.clear();
+    bands.clear();
+    entries.reserve(int(count));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QString name;
+        Entry e;
+        e.hash = 0;
+        e.focusX = e.focusY = -1;
+        in >> name >> e.modified >> e.bytes >> e.size;
+        if (version >= 2)
+            in >> e.hash;
+        if (version >= 3)
+            in >> e.focusX >> e.focusY;
+        entries.insert(name, e);
+        if (e.hash)
+            indexHash(name, e.hash);
+    }
+    if (in.status() != QDataStream::Ok) {
+        entries.clear();
+        bands.clear();
+    }
+    dirty = false;
+    Metrics::set("catalog/entries", entries.count());
+}
+
+void Catalog::clear()
+{
+    QMutexLocker lock(&mutex);
+    entries.clear();
+    bands.clear();
+    dirty = true;
+}
+
+bool Catalog::save()
+{
+    QMutexLocker lock(&mutex);
+    if (!dirty || fileName.isEmpty())
+        return true;
+    QSaveFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&f);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << catalogMagic << catalogVersion << quint32(entries.count());
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it)
+        out << it.key() << it->modified << it->bytes << it->size << it->hash
+            << it->focusX << it->focusY;
+    if (!f.commit())
+        return false;
+    dirty = false;
+    Metrics::set("catalog/entries", entries.count());
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <QHash>
+#include <QMultiHash>
+#include <QMutex>
+#include <QPointF>
+#include <QSize>
+#include <QString>
+
+class QFileInfo;
+class QImage;
+
+// What we know about library images without decoding them in full, kept
+// between runs in the config folder.  Entries are keyed by path and dropped
+// when the file's size or modification time no longer match, so an edited
+// image is looked at again.  Safe to use from render threads.
+//
+// Images also get a 64-bit difference hash (dHash) from a tiny decode, so
+// re-encodes, resizes and copies of one picture can be told apart from
+// different pictures: their hashes differ in a few bits at most.  Hashes
+// are indexed in eight 8-bit bands, and any two within nearBits of each
+// other share at least one band, so a lookup only compares a few buckets.
+// The same decode gives the crop focus: the centroid of its edge energy,
+// which is where the subject of a picture most likely is.
+class Catalog
+{
+public:
+    static Catalog *instance();
+
+    // Pixel size from the image header; invalid if it cannot be read.
+    QSize imageSize(const QString &fname);
+    // The image's hash, decoding it small if it or the crop focus is not
+    // known yet; 0 if it cannot be read.  Meant for the indexer's threads.
+    quint64 imageHash(const QString &fname);
+    // The hash if it is known already, 0 otherwise; never decodes.
+    quint64 knownHash(const QString &fname);
+    // A catalogued image other than except whose hash is within nearBits
+    // of hash; empty if there is none.
+    QString findNear(quint64 hash, const QString &except = QString());
+    bool hasHashes();
+    // Where the subject is, as fractions of the width and height, decoding
+    // the image small if it is not known yet; the middle if it cannot be
+    // read.
+    QPointF cropFocus(const QString &fname);
+    // The same if it is known already; never decodes.
+    bool knownFocus(const QString &fname, QPointF *focus);
+
+    static const int nearBits = 5;
+    static quint64 hashImage(const QImage &image);
+    static QPointF saliencyFocus(const QImage &image);
+    static int distance(quint64 a, quint64 b);
+
+    void load(const QString &fileName);
+    bool save();
+    // Forgets every image, as if nothing had been catalogued yet.
+    void clear();
+
+private:
+    struct Entry {
+        qint64 modified;
+        qint64 bytes;
+        QSize size;
+        quint64 hash;       // 0 until hashed
+        qint16 focusX;      // in 1/10000ths; -1 until analysed
+        qint16 focusY;
+    };
+
+    Catalog();
+    bool matches(const Entry &entry, const QFileInfo &info);
+    // hash and focus from one small decode; false if it cannot be read
+    bool analyse(const QString &fname);
+    void indexHash(const QString &fname, quint64 hash);
+    void unindexHash(const QString &fname, quint64 hash);
+
+    // band number in the top byte, its value below
+    static quint32 bandKey(quint64 hash, int band);
+
+    QMutex mutex;
+    QHash<QString, Entry> entries;
+    QMultiHash<quint32, QString> bands;
+    QString fileName;
+    bool dirty;
+};
+
+#endif // CATALOG_H
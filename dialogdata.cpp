@@ -0,0 +1,10 @@
+#include "dialogdata.h"
+
+const char *dialogdata::gravityStrings[] = {
+    "north", "northeast", "east", "southeast", "south", "southwest", "west",
+    "northwest", "center", "auto"
+};
+
+const char *dialogdata::filterStrings[] = {
+    "auto", "bilinear", "mitchell", "lanczos3"
+};
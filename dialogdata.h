@@ -0,0 +1,61 @@
+#ifndef DIALOGDATA_H
+#define DIALOGDATA_H
+
+#include <QColor>
+#include <QSize>
+#include <QStringList>
+#include "pathstore.h"
+
+enum Source { ImageSource, ListSource, FolderSource, DropSource, WebSource,
+              ArchiveSource, MixSource };
+enum Scaling { ScaledProportions, ScaledCropped, TiledNotScaled, NotScaled,
+               Mosaic };
+// Automatic crops around the subject in ScaledCropped mode and is Center
+// everywhere else
+enum Gravity { North, NorthEast, East, SouthEast, South, SouthWest, West,
+               NorthWest, Center, Automatic };
+enum Folder { ConfigFolder, ShmFolder, TmpFolder };
+enum Filter { AutomaticFilter, Bilinear, Mitchell, Lanczos3 };
+
+struct dialogdata {
+    Source source;
+    QString image;
+    QString listfile;
+    QString fileFolder;
+    QString archive;
+    QString mix;
+    PathStore droppedFiles;
+    QStringList webFields;
+    int webIndex;
+    int hr, mn, sc;
+    QColor bgcolor;
+    bool multiply;
+    Scaling scale;
+    int mosaicTiles;
+    Gravity weight;
+    QSize target;
+    Folder folder;
+    bool initOnce;
+    bool running;
+    bool xsetbg;
+    bool plasmaDBus;
+    bool nativeRender;
+    Filter filter;
+    bool alignDeadline;
+    bool progressive;
+    bool mirror;
+    int mirrorFrom, mirrorTo;   // hours; the same twice for any time
+    int mirrorRate;             // KiB/s, 0 for no cap
+    int mirrorQuota;            // MiB
+    QStringList overlays;
+
+    dialogdata() : listfile(), hr(0), mn(0), sc(10), bgcolor(48,48,48),
+        multiply(true), scale(ScaledProportions), mosaicTiles(12),
+        weight(SouthEast), nativeRender(false), filter(AutomaticFilter),
+        alignDeadline(false), progressive(false), mirror(false),
+        mirrorFrom(1), mirrorTo(6), mirrorRate(512), mirrorQuota(2048) { }
+    static const char *gravityStrings[];
+    static const char *filterStrings[];
+};
+
+#endif // DIALOGDATA_H
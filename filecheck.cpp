@@ -0,0 +1,155 @@
+#include "filecheck.h"
+#include "metrics.h"
+
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureInterface>
+#include <QSharedPointer>
+#include <QUrl>
+#include <QtConcurrent>
+#include <QtEndian>
+
+// candidates handed to a job at once, and images reported at most at once
+static const int batchCandidates = 256;
+// how long found images may wait for a batch to fill, in ms
+static const int reportInterval = 200;
+// a bmp's file header, and the info header sizes Windows and OS/2 write
+static const int bmpFileHeader = 14;
+static const quint32 bmpInfoHeaders[] = { 12, 40, 56, 108, 124 };
+
+// One check, shared by its jobs.  Results go straight into the future the
+// watcher follows, so nothing waits for a job, and jobs stop at the next
+// file once it is cancelled.
+struct CheckRun {
+    QFutureInterface<QStringList> future;
+    QAtomicInt jobs;
+};
+
+static void checkBatch(QSharedPointer<CheckRun> run, const QStringList &candidates,
+                       const QString &workingFolder)
+{
+    QStringList images;
+    QElapsedTimer sinceReport;
+    sinceReport.start();
+    auto add = [&](const QString &image) {
+        images.append(image);
+        if (images.count() >= batchCandidates
+                || sinceReport.elapsed() >= reportInterval) {
+            run->future.reportResult(images);
+            images.clear();
+            sinceReport.restart();
+        }
+    };
+    for (const QString &s : candidates) {
+        if (run->future.isCanceled())
+            break;
+        QString fileName = QUrl::fromUserInput(s, workingFolder).toLocalFile();
+        QFileInfo info(fileName);
+        if (info.isDir()) {
+            // a whole archive streams out as it is walked
+            QDirIterator it(fileName, QDir::Files | QDir::Readable,
+                            QDirIterator::Subdirectories
+                            | QDirIterator::FollowSymlinks);
+            while (it.hasNext() && !run->future.isCanceled())
+                if (FileCheck::isImage(it.next()))
+                    add(it.filePath());
+        } else if (FileCheck::isImage(fileName)) {
+            add(info.absoluteFilePath());
+        }
+    }
+    if (!images.isEmpty() && !run->future.isCanceled())
+        run->future.reportResult(images);
+    if (!run->jobs.deref())
+        run->future.reportFinished();
+}
+
+FileCheck::FileCheck(QObject *parent) : QObject(parent)
+{
+    watcher = new QFutureWatcher<QStringList>(this);
+    connect(watcher, &QFutureWatcher<QStringList>::resultReadyAt,
+            this, &FileCheck::watcher_resultReadyAt);
+    connect(watcher, &QFutureWatcher<QStringList>::finished,
+            this, &FileCheck::watcher_finished);
+}
+
+FileCheck::~FileCheck()
+{
+    cancel();
+}
+
+void FileCheck::start(const QStringList &candidates,
+                      const QString &workingFolder)
+{
+    cancel();
+    collected.clear();
+    QSharedPointer<CheckRun> run(new CheckRun);
+    int batches = (candidates.count() + batchCandidates - 1) / batchCandidates;
+    run->jobs.store(batches);
+    run->future.reportStarted();
+    watcher->setFuture(run->future.future());
+    if (!batches) {
+        run->future.reportFinished();
+        return;
+    }
+    for (int i = 0; i < candidates.count(); i += batchCandidates)
+        QtConcurrent::run(checkBatch, run, candidates.mid(i, batchCandidates),
+                          workingFolder);
+}
+
+void FileCheck::cancel()
+{
+    // the jobs notice at their next file; nobody waits for them
+    if (watcher->isRunning())
+        watcher->cancel();
+}
+
+bool FileCheck::isRunning() const
+{
+    return watcher->isRunning();
+}
+
+static bool isBmpHeader(const QByteArray &head, qint64 fileSize)
+{
+    // "BM" alone starts plenty of text files: the header must add up too
+    if (head.size() < bmpFileHeader + 4)
+        return false;
+    const uchar *p = reinterpret_cast<const uchar *>(head.constData());
+    quint32 size = qFromLittleEndian<quint32>(p + 2);
+    quint32 infoSize = qFromLittleEndian<quint32>(p + bmpFileHeader);
+    bool knownInfo = false;
+    for (quint32 known : bmpInfoHeaders)
+        knownInfo |= infoSize == known;
+    return knownInfo && size >= bmpFileHeader + infoSize && size <= fileSize;
+}
+
+bool FileCheck::isImage(const QString &fileName)
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray head = f.read(bmpFileHeader + 4);
+    if (head.startsWith("BM"))
+        return isBmpHeader(head, f.size());
+    return head.startsWith("\xff\xd8\xff")
+            || head.startsWith("\x89PNG\r\n\x1a\n")
+            || head.startsWith("GIF87a") || head.startsWith("GIF89a");
+}
+
+void FileCheck::watcher_resultReadyAt(int index)
+{
+    QStringList images = watcher->resultAt(index);
+    Metrics::add("filecheck/images", images.count());
+    if (images.isEmpty())
+        return;
+    collected.append(images);
+    emit found(images);
+}
+
+void FileCheck::watcher_finished()
+{
+    if (watcher->isCanceled())
+        return;
+    emit finished(collected);
+}
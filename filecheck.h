@@ -0,0 +1,40 @@
+#ifndef FILECHECK_H
+#define FILECHECK_H
+
+#include <QFutureWatcher>
+#include <QObject>
+#include <QStringList>
+
+// Sorts the images out of a pile of candidates (paths or urls, relative to
+// a working folder; folders are searched) on the global thread pool,
+// going by the first bytes of each file rather than its name.  Images come
+// back in batches as they are found, folders too while they are walked,
+// so the first can be used long before the last is checked.  Starting a
+// new check cancels one still running, without waiting for it.
+class FileCheck : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileCheck(QObject *parent = nullptr);
+    ~FileCheck();
+    void start(const QStringList &candidates,
+               const QString &workingFolder = QString());
+    void cancel();
+    bool isRunning() const;
+
+    // jpeg, png, gif or bmp, by magic bytes; for bmp, a header that fits
+    static bool isImage(const QString &fileName);
+
+signals:
+    void found(const QStringList &files);
+    void finished(const QStringList &files);
+
+private:
+    void watcher_resultReadyAt(int index);
+    void watcher_finished();
+
+    QFutureWatcher<QStringList> *watcher;
+    QStringList collected;
+};
+
+#endif // FILECHECK_H
@@ -0,0 +1,147 @@
+#include "framepool.h"
+#include "metrics.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// free buffers kept around between changes
+static const int maxFreeBuffers = 6;
+// largest buffer kept, in target frames (a source a bit bigger than the
+// screen still gets recycled, a 12000x8000 scan does not)
+static const int maxBufferFrames = 4;
+
+static size_t pageRound(size_t bytes)
+{
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    return (bytes + page - 1) / page * page;
+}
+
+FramePool *FramePool::instance()
+{
+    static FramePool pool;
+    return &pool;
+}
+
+FramePool::FramePool() : freeBytes(0), target(1920, 1080)
+{
+
+}
+
+FramePool::~FramePool()
+{
+    trim();
+}
+
+QImage FramePool::acquire(const QSize &size, QImage::Format format)
+{
+    int depth = QImage::toPixelFormat(format).bitsPerPixel();
+    if (size.isEmpty() || depth == 0)
+        return QImage(size, format);
+
+    int bytesPerLine = ((size.width() * depth + 31) >> 5) << 2;
+    size_t bytes = size_t(bytesPerLine) * size_t(size.height());
+    Buffer buffer;
+    if (!take(bytes, buffer)) {
+        buffer.bytes = pageRound(bytes);
+        void *data = mmap(nullptr, buffer.bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+            return QImage(size, format);
+        buffer.data = static_cast<uchar*>(data);
+        Metrics::add("framepool/allocations");
+    } else {
+        Metrics::add("framepool/reuses");
+    }
+    Lease *lease = new Lease { this, buffer };
+    return QImage(buffer.data, size.width(), size.height(), bytesPerLine,
+                  format, &FramePool::release, lease);
+}
+
+void FramePool::setTarget(const QSize &target)
+{
+    {
+        QMutexLocker lock(&mutex);
+        if (this->target == target)
+            return;
+        this->target = target;
+    }
+    // buffers sized for the old target are no use now
+    trim();
+}
+
+void FramePool::trim()
+{
+    QMutexLocker lock(&mutex);
+    for (const Buffer &b : free)
+        unmap(b);
+    free.clear();
+    freeBytes = 0;
+    updateMetrics();
+}
+
+bool FramePool::take(size_t bytes, Buffer &buffer)
+{
+    QMutexLocker lock(&mutex);
+    int best = -1;
+    for (int i = 0; i < free.count(); i++) {
+        size_t size = free[i].bytes;
+        if (size >= bytes && (best < 0 || size < free[best].bytes))
+            best = i;
+    }
+    // do not tie up a whole frame for a thumbnail
+    if (best < 0 || free[best].bytes > 2 * pageRound(bytes))
+        return false;
+    buffer = free.takeAt(best);
+    freeBytes -= buffer.bytes;
+    updateMetrics();
+    return true;
+}
+
+void FramePool::giveBack(const Buffer &buffer)
+{
+    QMutexLocker lock(&mutex);
+    if (buffer.bytes > maxBufferBytes()) {
+        unmap(buffer);
+        return;
+    }
+    if (free.count() >= maxFreeBuffers) {
+        // keep the larger buffers, they are the expensive ones
+        int smallest = 0;
+        for (int i = 1; i < free.count(); i++)
+            if (free[i].bytes < free[smallest].bytes)
+                smallest = i;
+        if (free[smallest].bytes > buffer.bytes) {
+            unmap(buffer);
+            return;
+        }
+        freeBytes -= free[smallest].bytes;
+        unmap(free.takeAt(smallest));
+    }
+    free.append(buffer);
+    freeBytes += buffer.bytes;
+    updateMetrics();
+}
+
+size_t FramePool::maxBufferBytes()
+{
+    return size_t(maxBufferFrames) * 4 * size_t(target.width())
+            * size_t(target.height());
+}
+
+void FramePool::unmap(const Buffer &buffer)
+{
+    munmap(buffer.data, buffer.bytes);
+}
+
+void FramePool::updateMetrics()
+{
+    Metrics::set("framepool/freeBuffers", free.count());
+    Metrics::set("framepool/freeBytes", qint64(freeBytes));
+}
+
+void FramePool::release(void *info)
+{
+    Lease *lease = static_cast<Lease*>(info);
+    lease->pool->giveBack(lease->buffer);
+    delete lease;
+}
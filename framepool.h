@@ -0,0 +1,50 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QSize>
+
+// Recycles the large pixel buffers the in-process renderer goes through
+// (decoded source, scaled layer, background canvas), so a change does not
+// allocate and free tens of megabytes each time.  Buffers are mapped
+// directly from the kernel and handed out as QImages that give their
+// memory back to the pool when the last copy goes away.  Only buffers up
+// to a few frames of the current target are kept; anything bigger goes
+// straight back to the system.
+class FramePool
+{
+public:
+    static FramePool *instance();
+    ~FramePool();
+
+    QImage acquire(const QSize &size, QImage::Format format);
+    void setTarget(const QSize &target);
+    void trim();
+
+private:
+    struct Buffer {
+        uchar *data;
+        size_t bytes;
+    };
+    struct Lease {
+        FramePool *pool;
+        Buffer buffer;
+    };
+
+    FramePool();
+    bool take(size_t bytes, Buffer &buffer);
+    void giveBack(const Buffer &buffer);
+    size_t maxBufferBytes();
+    void unmap(const Buffer &buffer);
+    void updateMetrics();
+    static void release(void *info);
+
+    QMutex mutex;
+    QList<Buffer> free;
+    size_t freeBytes;
+    QSize target;
+};
+
+#endif // FRAMEPOOL_H
@@ -0,0 +1,62 @@
+#include "librarybrowser.h"
+
+#include <QVBoxLayout>
+
+static const int thumbnailSide = 128;
+static const int cellWidth = 160;
+static const int cellHeight = 160;
+static const int layoutBatch = 512;
+
+// list mode's layout, icon mode's look
+class ThumbnailView : public QListView
+{
+public:
+    using QListView::QListView;
+
+protected:
+    QStyleOptionViewItem viewOptions() const override
+    {
+        QStyleOptionViewItem option = QListView::viewOptions();
+        option.decorationPosition = QStyleOptionViewItem::Top;
+        option.displayAlignment = Qt::AlignHCenter | Qt::AlignBottom;
+        return option;
+    }
+};
+
+LibraryBrowser::LibraryBrowser(QWidget *parent) : QWidget(parent)
+{
+    model = new LibraryModel(this);
+    summary = new QLabel(this);
+
+    view = new ThumbnailView(this);
+    view->setModel(model);
+    // list mode with wrapping keeps no item objects, unlike icon mode
+    view->setViewMode(QListView::ListMode);
+    view->setFlow(QListView::LeftToRight);
+    view->setWrapping(true);
+    view->setResizeMode(QListView::Adjust);
+    view->setUniformItemSizes(true);
+    view->setLayoutMode(QListView::Batched);
+    view->setBatchSize(layoutBatch);
+    view->setIconSize(QSize(thumbnailSide, thumbnailSide));
+    view->setGridSize(QSize(cellWidth, cellHeight));
+    view->setTextElideMode(Qt::ElideMiddle);
+    view->setSelectionMode(QAbstractItemView::SingleSelection);
+    connect(view, &QListView::activated, this, [this](const QModelIndex &index) {
+        QString fileName = model->fileName(index);
+        if (!fileName.isEmpty())
+            emit fileActivated(fileName);
+    });
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(summary);
+    layout->addWidget(view);
+    resize(cellWidth * 5 + 40, cellHeight * 4 + 60);
+}
+
+void LibraryBrowser::setFiles(const QString &title, const PathStore &files)
+{
+    setWindowTitle(tr("Library - %1").arg(title));
+    summary->setText(tr("%n image(s)", nullptr, files.count()));
+    model->setFiles(files);
+}
@@ -0,0 +1,29 @@
+#ifndef LIBRARYBROWSER_H
+#define LIBRARYBROWSER_H
+
+#include <QLabel>
+#include <QListView>
+#include <QWidget>
+#include "librarymodel.h"
+
+// A window showing what a source holds, as a grid of thumbnails.  The
+// view lays out uniform items in batches and only ever asks the model for
+// the rows on screen, so it scrolls through millions of files in bounded
+// memory.  Activating a file makes it the wallpaper.
+class LibraryBrowser : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit LibraryBrowser(QWidget *parent = nullptr);
+    void setFiles(const QString &title, const PathStore &files);
+
+signals:
+    void fileActivated(const QString &fileName);
+
+private:
+    LibraryModel *model;
+    QListView *view;
+    QLabel *summary;
+};
+
+#endif // LIBRARYBROWSER_H
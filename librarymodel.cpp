@@ -0,0 +1,82 @@
+#include "librarymodel.h"
+
+#include <QFileInfo>
+
+// thumbnails kept, a few screens' worth at about 64k each
+static const int cachedThumbnails = 600;
+static const int placeholderSide = 128;
+// outstanding requests remembered; far more than can be waiting at once
+static const int maxRequested = 2048;
+
+LibraryModel::LibraryModel(QObject *parent)
+    : QAbstractListModel(parent)
+    , placeholder(placeholderSide, placeholderSide)
+    , thumbnails(cachedThumbnails)
+{
+    placeholder.fill(Qt::transparent);
+    thumbnailer = new Thumbnailer(this);
+    connect(thumbnailer, &Thumbnailer::ready,
+            this, &LibraryModel::thumbnailer_ready);
+}
+
+void LibraryModel::setFiles(const PathStore &files)
+{
+    beginResetModel();
+    this->files = files;
+    thumbnailer->clear();
+    thumbnails.clear();
+    requested.clear();
+    endResetModel();
+}
+
+QString LibraryModel::fileName(const QModelIndex &index) const
+{
+    if (!index.isValid() || index.row() >= files.count())
+        return QString();
+    return files.at(index.row());
+}
+
+int LibraryModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : files.count();
+}
+
+QVariant LibraryModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= files.count())
+        return QVariant();
+    int row = index.row();
+    switch (role) {
+    case Qt::DisplayRole:
+        return QFileInfo(files.at(row)).fileName();
+    case Qt::ToolTipRole:
+        return files.at(row);
+    case Qt::DecorationRole: {
+        if (QPixmap *thumbnail = thumbnails.object(row))
+            return thumbnail->isNull() ? placeholder : *thumbnail;
+        QString fileName = files.at(row);
+        if (!requested.contains(fileName)) {
+            // answers for rows long gone are dropped with the rest
+            if (requested.count() > maxRequested)
+                requested.clear();
+            requested.insert(fileName, row);
+        }
+        thumbnailer->request(fileName);
+        return placeholder;
+    }
+    default:
+        return QVariant();
+    }
+}
+
+void LibraryModel::thumbnailer_ready(const QString &fileName, const QImage &image)
+{
+    auto it = requested.find(fileName);
+    if (it == requested.end())
+        return;
+    int row = *it;
+    requested.erase(it);
+    thumbnails.insert(row, new QPixmap(QPixmap::fromImage(image)));
+    QModelIndex i = index(row);
+    emit dataChanged(i, i, { Qt::DecorationRole });
+}
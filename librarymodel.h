@@ -0,0 +1,39 @@
+#ifndef LIBRARYMODEL_H
+#define LIBRARYMODEL_H
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QHash>
+#include <QPixmap>
+#include "pathstore.h"
+#include "thumbnailer.h"
+
+// The files of a source for a view with uniform item sizes.  Nothing is
+// kept per row: paths come out of the PathStore and thumbnails are only
+// asked for when the view asks for a row, which it only does for those on
+// screen.  Thumbnails live in a cache of bounded size, and ones that fell
+// out are asked for again when their row comes back into view.
+class LibraryModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit LibraryModel(QObject *parent = nullptr);
+
+    void setFiles(const PathStore &files);
+    QString fileName(const QModelIndex &index) const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+private:
+    void thumbnailer_ready(const QString &fileName, const QImage &image);
+
+    Thumbnailer *thumbnailer;
+    PathStore files;
+    QPixmap placeholder;
+    // by row; a null pixmap marks a file with no thumbnail to be had
+    mutable QCache<int, QPixmap> thumbnails;
+    mutable QHash<QString, int> requested;
+};
+
+#endif // LIBRARYMODEL_H
@@ -1,4 +1,17 @@
 #include "main.h"
+#include "render.h"
+#include "metrics.h"
+#include "framepool.h"
+#include "powerwatch.h"
+#include "priority.h"
+#include "overlay.h"
+#include "x11publisher.h"
+#include "mosaic.h"
+#include "catalog.h"
+#include "rendercache.h"
+#include "pyramid.h"
+#include "mirror.h"
+#include "qtcompat.h"
 #include <QApplication>
 #include <QSettings>
 #include <QLockFile>
@@ -12,14 +25,53 @@
 #include <QLocalSocket>
 #include <QDesktopServices>
 #include <QUrl>
+#include <QStandardPaths>
+#include <QRegExp>
+#include <QElapsedTimer>
+#include <QThread>
+#include <functional>
+#include <algorithm>
+#include <QtConcurrent>
+#include <unistd.h>
 
 static QString configFolderPath;
-static const char serverName[] = "cmdrkotori.qt314wall";
+static const char serverNameBase[] = "cmdrkotori.qt314wall";
 static const int serverTimeout = 1000;
 static const char orgDomain[] = "cmdrkotori.github.com";
 static const char configFolderTitle[] = "qt314wall";
 static const char workingDirNameShm[] = "/dev/shm/qt314-wallpaper";
 static const char workingDirNameTmp[] = "/tmp/qt314-wallpaper";
+static const char pyramidFolderName[] = "pyramid";
+// where the pyramid used to live, inside each working folder
+static const char oldPyramidFolderName[] = ".pyramid";
+static const char scratchNamePrefix[] = "/dev/shm/qt314wall-";
+// per user (server, publish folders) and per process (scratch images), so
+// sessions sharing a machine keep out of each other's way; set in main
+static QString serverName;
+static QString workingDirShm;
+static QString workingDirTmp;
+static QString tempImageName;
+static QString pendingImageName;
+static QString previewImageName;
+static const int previewBudgetMs = 100;
+static const int coalesceTimeout = 250;
+
+// bumped whenever a request makes the work in flight obsolete; jobs
+// compare it with the one they started under and give up when it moved
+static QAtomicInt renderGeneration;
+static const char metricsFileName[] = "metrics.json";
+static const char catalogFileName[] = "catalog.dat";
+static const char droppedFilesName[] = "droppedfiles.paths";
+static const char mirrorFolderName[] = "mirror";
+static const int idleTrimTimeout = 300000;
+// files hashed per indexing job
+static const int indexChunk = 64;
+// images whose hashes are remembered as shown lately
+static const int recentHashCount = 50;
+// near-duplicates passed over in a row before one is shown anyway
+static const int maxDuplicateSkips = 3;
+// bumped to stop the indexing jobs of a library that is no longer shown
+static QAtomicInt indexGeneration;
 
 int main(int argc, char *argv[])
 {
@@ -27,14 +79,32 @@ int main(int argc, char *argv[])
     QSettings::setDefaultFormat(QSettings::IniFormat);
 
     QApplication a(argc, argv);
+    QString user = QString::number(getuid());
+    QString scratch = scratchNamePrefix + QString::number(a.applicationPid());
+    serverName = QString("%1-%2").arg(serverNameBase, user);
+    workingDirShm = QString("%1-%2").arg(workingDirNameShm, user);
+    workingDirTmp = QString("%1-%2").arg(workingDirNameTmp, user);
+    tempImageName = scratch + "-tempimage.png";
+    pendingImageName = scratch + "-pendingimage.png";
+    previewImageName = scratch + "-previewimage.png";
     if (Flow::passToPrevious(a.arguments().mid(1)))
         return 0;
 
     configFolderPath = QFileInfo(QSettings(configFolderTitle, configFolderTitle).fileName()).absolutePath() + "/";
 
     // prep slideshow directories
-    QDir("/").mkpath(workingDirNameShm);
-    QDir("/").mkpath(workingDirNameTmp);
+    for (const QString &dir : { workingDirShm, workingDirTmp }) {
+        QDir("/").mkpath(dir);
+        QFile::setPermissions(dir, QFile::ReadOwner | QFile::WriteOwner
+                                   | QFile::ExeOwner);
+    }
+    // the pyramid is disk cache, not something to keep in RAM or config
+    for (const QString &dir : { workingDirShm, workingDirTmp, configFolderPath })
+        QDir(dir + "/" + oldPyramidFolderName).removeRecursively();
+    QString cacheFolder = QStandardPaths::writableLocation(
+                QStandardPaths::CacheLocation);
+    if (!cacheFolder.isEmpty())
+        Pyramid::setFolder(cacheFolder + "/" + pyramidFolderName);
 
     Flow f;
     f.run();
@@ -43,17 +113,84 @@ int main(int argc, char *argv[])
 
 
 Flow::Flow(QObject *parent) : QObject(parent),
-    window(NULL), sysicon(NULL), ctxmenu(NULL), timer(NULL),
-    converter(NULL), rgen(rseed()), requestingSource(false)
+    window(NULL), browser(NULL), sysicon(NULL), ctxmenu(NULL), scheduler(NULL),
+    idleTimer(NULL), powerWatch(NULL), fileCheck(NULL),
+    converter(NULL), renderWatcher(NULL), previewWatcher(NULL),
+    engine(new Render::Engine),
+    overlays(new OverlayStack),
+    rgen(rseed()), coalesceTimer(NULL), watchedGeneration(0),
+    requestingSource(false), scheduledRequest(false), unlockRequest(false),
+    unlockReady(false), previewPending(false), coalescedRequest(false),
+    fileCheckApplied(false), startupRequest(false), convertFallback(false),
+    duplicateSkips(0), mosaicTiles(0)
 {
     window = new MainWindow();
     connect(window, &MainWindow::dataChanged, this, &Flow::dialogDataChanged);
+    connect(window, &MainWindow::libraryRequested, this, &Flow::library_triggered);
 
-    converter = new QProcess(this);
+    converter = new IdleProcess(this);
     connect(converter, SIGNAL(finished(int)), this, SLOT(changeWallConvertFinished(int)));
 
-    timer = new QTimer(this);
-    connect(timer, &QTimer::timeout, this, &Flow::requestNextImage);
+    // one job at a time, so a stale job is never writing next to a new one
+    renderPool.setMaxThreadCount(1);
+    renderWatcher = new QFutureWatcher<QImage>(this);
+    connect(renderWatcher, &QFutureWatcher<QImage>::finished, this, [this]() {
+        if (watchedGeneration != renderGeneration.load())
+            return;
+        QImage frame = renderWatcher->result();
+        // the job only found the focus, or the cached frame went before it
+        // got to it: convert after all
+        if (frame.isNull() && convertFallback) {
+            convertFallback = false;
+            // the focus is known by now, so the frame can be cached
+            renderKey = RenderCache::key(activeSourceFilename,
+                                         Render::Params(settings), false);
+            startConvert(Render::Params(settings));
+            return;
+        }
+        renderFinished(!frame.isNull(), frame);
+    });
+
+    // clicks in a burst: the first goes through, the last one when it ends
+    coalesceTimer = new QTimer(this);
+    coalesceTimer->setSingleShot(true);
+    coalesceTimer->setInterval(coalesceTimeout);
+    connect(coalesceTimer, &QTimer::timeout, this, [this]() {
+        if (coalescedRequest) {
+            coalescedRequest = false;
+            userRequest();
+        }
+    });
+
+    // hashing runs at idle priority beside the renders, on half the cores
+    indexPool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() / 2));
+
+    // previews get their own thread, one that render jobs never made idle
+    previewPool.setMaxThreadCount(1);
+    previewWatcher = new QFutureWatcher<QImage>(this);
+    connect(previewWatcher, &QFutureWatcher<QImage>::finished, this, [this]() {
+        previewFinished(previewWatcher->result());
+    });
+
+    scheduler = new Scheduler(this);
+    connect(scheduler, &Scheduler::prepare, this, &Flow::scheduler_prepare);
+    connect(scheduler, &Scheduler::publish, this, &Flow::scheduler_publish);
+
+    powerWatch = new PowerWatch(this);
+    connect(powerWatch, &PowerWatch::changed, this, &Flow::power_changed);
+
+    fileCheck = new FileCheck(this);
+    connect(fileCheck, &FileCheck::found, this, &Flow::fileCheck_found);
+    connect(fileCheck, &FileCheck::finished, this, &Flow::fileCheck_finished);
+
+    // let go of the render buffers if nothing has happened for a while
+    idleTimer = new QTimer(this);
+    idleTimer->setSingleShot(true);
+    idleTimer->setInterval(idleTrimTimeout);
+    connect(idleTimer, &QTimer::timeout, this, []() {
+        FramePool::instance()->trim();
+        Catalog::instance()->save();
+    });
 
     if (QSystemTrayIcon::isSystemTrayAvailable())
         setupSysicon();
@@ -63,10 +200,16 @@ Flow::Flow(QObject *parent) : QObject(parent),
 Flow::~Flow()
 {
     removeActiveFile();
+    indexGeneration.ref();
+    indexPool.waitForDone();
+    for (const QString &scratch : { tempImageName, pendingImageName, previewImageName })
+        QFile::remove(scratch);
+    Catalog::instance()->save();
     if (ctxmenu)    delete ctxmenu;
     if (sysicon)    delete sysicon;
     if (window)     delete window;
-    if (timer)      delete timer;
+    if (browser)    delete browser;
+    if (scheduler)  delete scheduler;
 }
 
 bool Flow::passToPrevious(const QStringList &files)
@@ -86,17 +229,23 @@ bool Flow::passToPrevious(const QStringList &files)
 
 void Flow::run()
 {
+    Catalog::instance()->load(configFolderPath + catalogFileName);
     setupSources();
     setupServer();
     fetchSettings();
-    if (QApplication::arguments().count() > 1)
-        maybeSetToFiles(QApplication::arguments().mid(1), QDir::currentPath());
+    // files on the command line take over once the first of them checks out
+    bool checking = QApplication::arguments().count() > 1;
+    if (checking)
+        checkFiles(QApplication::arguments().mid(1), QDir::currentPath());
     updateTimerInterval();
     updateDestFolder();
-    updateTargetString();
     updateEnabled();
     updateSources();
-    if (settings.initOnce)
+    updateOverlays();
+    // with files to check, the first wallpaper waits for what they turn out
+    // to be
+    startupRequest = settings.initOnce && checking;
+    if (settings.initOnce && !checking)
         requestNextImage();
     window->setData(settings);
     if (sysicon)
@@ -121,11 +270,7 @@ void Flow::server_newConnection()
         show_triggered();
         return;
     }
-    if (!maybeSetToFiles(lines.mid(1), lines.first()))
-        return;
-
-    window->setData(settings);
-    dialogDataChanged(settings);
+    checkFiles(lines.mid(1), lines.first());
 }
 
 void Flow::show_triggered()
@@ -140,11 +285,9 @@ void Flow::enabled_triggered(bool state)
     settings.running = state;
     window->setRunning(state);
     storeSettings();
-    if (state) {
+    updateTimerInterval();
+    if (state)
         requestNextImage();
-    } else {
-        timer->stop();
-    }
 }
 
 void Flow::openImage_triggered()
@@ -158,31 +301,109 @@ void Flow::openSource_triggered()
     QDesktopServices::openUrl(activeSource->source());
 }
 
+void Flow::library_triggered()
+{
+    QList<Sources::FileListSource*> library = librarySources();
+    PathStore files;
+    if (settings.source == ImageSource) {
+        files = PathStore(QStringList { settings.image });
+    } else if (library.count() == 1) {
+        files = library.first()->files();
+    } else {
+        QStringList all;
+        for (auto list : library)
+            all.append(list->files().toList());
+        files = PathStore(all);
+    }
+    if (!browser) {
+        browser = new LibraryBrowser();
+        browser->setAttribute(Qt::WA_QuitOnClose, false);
+        connect(browser, &LibraryBrowser::fileActivated,
+                this, &Flow::library_fileActivated);
+    }
+    Sources::FileSource *source = selectedSource();
+    browser->setFiles(source ? source->shortName() : QString(), files);
+    browser->showNormal();
+    browser->activateWindow();
+}
+
+void Flow::library_fileActivated(const QString &fileName)
+{
+    abandonScheduled();
+    cancelPending();
+    item = fileName;
+    if (!changeOneWall())
+        renderFailed();
+}
+
 void Flow::nextImage_triggered()
 {
-    requestNextImage();
+    if (coalesceTimer->isActive()) {
+        coalescedRequest = true;
+        Metrics::add("render/coalesced");
+    } else {
+        userRequest();
+    }
+    coalesceTimer->start();
+}
+
+// true if both pick images from the same place
+static bool sameSource(const dialogdata &a, const dialogdata &b)
+{
+    return a.source == b.source && a.image == b.image
+            && a.listfile == b.listfile && a.fileFolder == b.fileFolder
+            && a.archive == b.archive && a.mix == b.mix
+            && a.droppedFiles == b.droppedFiles && a.webFields == b.webFields
+            && a.webIndex == b.webIndex;
 }
 
 void Flow::dialogDataChanged(const dialogdata &d)
 {
+    // when only the look changed, show it on the current image right away
+    bool rerender = !activeSourceFilename.isEmpty() && sameSource(settings, d)
+            && (!(Render::Params(settings) == Render::Params(d))
+                || settings.overlays != d.overlays);
+    // the mix keeps what it fetched ahead unless where it fetches changed
+    bool newSources = !sameSource(settings, d) || settings.folder != d.folder;
     settings = d;
     storeSettings();
     updateTimerInterval();
     updateDestFolder();
-    updateTargetString();
     updateEnabled();
-    updateSources();
-    requestNextImage();
+    updateSources(newSources);
+    updateOverlays();
+    userRequest(rerender);
 }
 
 void Flow::source_nextFile(QString file)
 {
+    if (!requestingSource)
+        return;
     requestingSource = false;
-    if (!file.isEmpty()) {
-        item = file;
-        changeOneWall();
+    // near-duplicates of what was shown lately are passed over; only
+    // hashes the indexer already has count, nothing is decoded here
+    quint64 hash = file.isEmpty() ? 0 : Catalog::instance()->knownHash(file);
+    bool shownLately = std::any_of(recentHashes.begin(), recentHashes.end(),
+                                   [hash](quint64 recent) {
+        return Catalog::distance(recent, hash) <= Catalog::nearBits;
+    });
+    if (hash && shownLately && settings.source != ImageSource
+            && duplicateSkips < maxDuplicateSkips && activeSource) {
+        duplicateSkips++;
+        Metrics::add("catalog/duplicatesSkipped");
+        requestingSource = true;
+        activeSource->fetchFile();
+        return;
     }
-    updateTimerInterval();
+    duplicateSkips = 0;
+    if (hash) {
+        recentHashes.append(hash);
+        if (recentHashes.count() > recentHashCount)
+            recentHashes.removeFirst();
+    }
+    item = file;
+    if (file.isEmpty() || !changeOneWall())
+        renderFailed();
 }
 
 void Flow::changeWall()
@@ -194,19 +415,130 @@ void Flow::changeWall()
 
 void Flow::changeWallConvertFinished(int exitCode)
 {
+    if (watchedGeneration != renderGeneration.load())
+        return;
     if (exitCode) {
         qDebug() << converter->readAllStandardError();
+        renderFailed();
+        return;
+    }
+    // decoded once for the cache, the overlays and the publisher
+    QSharedPointer<OverlayStack> stack = overlays;
+    QString key = renderKey;
+    int generation = watchedGeneration;
+    QDateTime shownAt = publishTime();
+    renderWatcher->setFuture(QtConcurrent::run(&renderPool,
+            [stack, key, generation, shownAt]() {
+        if (generation != renderGeneration.load())
+            return QImage();
+        Priority::makeIdle();
+        QImage wall(tempImageName);
+        if (wall.isNull())
+            return QImage();
+        RenderCache::store(key, wall);
+        if (stack->isEmpty())
+            return wall;
+        stack->apply(wall, shownAt);
+        return wall.save(tempImageName) ? wall : QImage();
+    }));
+}
+
+void Flow::renderFinished(bool ok, const QImage &frame)
+{
+    previewPending = false;
+    if (!ok) {
+        renderFailed();
+        return;
+    }
+    if (scheduledRequest || unlockRequest) {
+        // hold it back until the deadline or the unlock
+        QFile::remove(pendingImageName);
+        QFile::rename(tempImageName, pendingImageName);
+        pendingFrame = frame;
+        if (unlockRequest) {
+            unlockRequest = false;
+            unlockReady = true;
+        } else {
+            scheduledRequest = false;
+            scheduler->rendered();
+        }
+        return;
+    }
+    publishWall(tempImageName, frame);
+}
+
+void Flow::previewFinished(const QImage &frame)
+{
+    // the full render beat it, or it is for an image since replaced
+    if (!previewPending || frame.isNull()) {
+        QFile::remove(previewImageName);
+        return;
+    }
+    previewPending = false;
+    Metrics::add("render/previews");
+    publishWall(previewImageName, frame, true);
+}
+
+void Flow::power_changed()
+{
+    bool locked = powerWatch->screenLocked();
+    updateTimerInterval();
+    if (!settings.running)
         return;
+    switch (PowerWatch::unlockStep(locked, unlockReady)) {
+    case PowerWatch::PrepareFrame:
+        // have one ready for whenever the screen comes back
+        unlockRequest = true;
+        requestNextImage();
+        break;
+    case PowerWatch::ShowFrame:
+        unlockReady = false;
+        publishWall(pendingImageName, pendingFrame);
+        pendingFrame = QImage();
+        break;
+    case PowerWatch::NothingToDo:
+        break;
+    }
+}
+
+void Flow::scheduler_prepare()
+{
+    scheduledRequest = true;
+    requestNextImage();
+}
+
+void Flow::scheduler_publish()
+{
+    publishWall(pendingImageName, pendingFrame);
+    pendingFrame = QImage();
+}
+
+void Flow::renderFailed()
+{
+    previewPending = false;
+    if (scheduledRequest) {
+        scheduledRequest = false;
+        scheduler->abandon();
     }
+    unlockRequest = false;
+    Metrics::add("render/failed");
+}
 
-    QFile org("/dev/shm/qt314wall-tempimage.png");
+void Flow::publishWall(const QString &renderedFile, const QImage &frame,
+                       bool preview)
+{
+    // convert only leaves a file, but decoding it here still beats
+    // starting xsetbg to do the same
+    bool publishedToX11 = settings.xsetbg && X11Publisher::isAvailable()
+            && X11Publisher::publish(frame.isNull() ? QImage(renderedFile) : frame);
+    QFile org(renderedFile);
     std::uniform_int_distribution<uint64_t> dist(0, (uint64_t)-1ll);
     QString filename = QString("%1.png").arg(dist(rgen));
     org.copy(this->destfolder + "/" + filename);
     removeActiveFile();
     org.remove();
     generatedFilename = filename;
-    if (settings.xsetbg)
+    if (settings.xsetbg && !publishedToX11)
         QProcess::startDetached("xsetbg", QStringList() <<
                                 this->destfolder + generatedFilename);
     if (settings.plasmaDBus) {
@@ -222,6 +554,12 @@ void Flow::changeWallConvertFinished(int exitCode)
             plasma.call("evaluateScript", script);
         }
     }
+    idleTimer->start();
+    // the full render follows a preview shortly, announce only that one
+    if (preview)
+        return;
+    Metrics::add("render/published");
+    Metrics::write(configFolderPath + metricsFileName);
     sysicon->showMessage("Cutie-pie Wallpaper Changer", "New wallpaper", QIcon(), 3000);
 }
 
@@ -263,6 +601,11 @@ void Flow::setupSysicon()
     connect(a, &QAction::triggered, this, &Flow::openSource_triggered);
     ctxmenu->addAction(a);
 
+    a = new QAction(this);
+    a->setText(tr("Browse Library"));
+    connect(a, &QAction::triggered, this, &Flow::library_triggered);
+    ctxmenu->addAction(a);
+
     ctxmenu->addSeparator();
 
     a = new QAction(this);
@@ -275,20 +618,28 @@ void Flow::setupSysicon()
 
 void Flow::setupSources()
 {
+    // sources in a mix answer the mix, not us
     auto sourceConnect = [this](Sources::FileSource *source) {
         connect(source, &Sources::FileSource::nextFile,
-                this, &Flow::source_nextFile);
+                this, [this,source](QString file) {
+            if (source == activeSource)
+                source_nextFile(file);
+        });
     };
 
     fileSource = new Sources::FileSource(this);
     fileListSource = new Sources::FileListSource(this);
     folderSource = new Sources::FolderSource(this);
     dropSource = new Sources::DropSource(this);
+    archiveSource = new Sources::ArchiveSource(this);
+    mixSource = new Sources::MixSource(this);
 
     sourceConnect(fileSource);
     sourceConnect(fileListSource);
     sourceConnect(folderSource);
     sourceConnect(dropSource);
+    sourceConnect(archiveSource);
+    sourceConnect(mixSource);
     struct WebData {
         QString title,hostname,apiPage;
     };
@@ -314,21 +665,41 @@ void Flow::setupServer()
     server.listen(serverName);
 }
 
-bool Flow::maybeSetToFiles(const QStringList &candidates, const QString &workingFolder)
+void Flow::checkFiles(const QStringList &candidates, const QString &workingFolder)
 {
-    QStringList files;
-    QStringList validExtensions({ "jpg", "jpeg", "jpe", "png", "bmp", "dib", "gif" });
-    for (const QString &s : candidates) {
-        QString filename = QUrl::fromUserInput(s, workingFolder).toLocalFile();
-        QFileInfo fileinfo(filename);
-        if (fileinfo.exists() && validExtensions.contains(fileinfo.suffix().toLower()))
-            files.append(filename);
+    fileCheckApplied = false;
+    fileCheck->start(candidates, workingFolder);
+}
+
+void Flow::fileCheck_found(const QStringList &files)
+{
+    // switch over on the first batch; the rest is filled in when done
+    if (fileCheckApplied)
+        return;
+    fileCheckApplied = true;
+    startupRequest = false;
+    dialogdata d = settings;
+    d.droppedFiles = PathStore(files);
+    d.source = DropSource;
+    window->setData(d);
+    dialogDataChanged(d);
+}
+
+void Flow::fileCheck_finished(const QStringList &files)
+{
+    // none of them was an image: start up from the settings after all
+    if (!fileCheckApplied && startupRequest) {
+        startupRequest = false;
+        requestNextImage();
+        return;
     }
-    if (files.count() < 1)
-        return false;
-    settings.droppedFiles = files;
-    settings.source = DropSource;
-    return true;
+    if (!fileCheckApplied || settings.source != DropSource
+            || files.count() == settings.droppedFiles.count())
+        return;
+    settings.droppedFiles = PathStore(files);
+    storeSettings();
+    dropSource->setFiles(settings.droppedFiles);
+    window->setData(settings);
 }
 
 void Flow::storeSettings()
@@ -338,7 +709,20 @@ void Flow::storeSettings()
     s.setValue("image", settings.image);
     s.setValue("listfile", settings.listfile);
     s.setValue("filefolder", settings.fileFolder);
-    s.setValue("droppedfiles", settings.droppedFiles);
+    s.setValue("archive", settings.archive);
+    s.setValue("mix", settings.mix);
+    // the dropped files live in their own file, written when they change
+    if (settings.droppedFiles == storedDroppedFiles
+            || settings.droppedFiles.save(configFolderPath + droppedFilesName)) {
+        storedDroppedFiles = settings.droppedFiles;
+        s.setValue("droppedpaths", droppedFilesName);
+        s.remove("droppedfiles");
+    } else {
+        // kept the old way until the paths file can be written
+        Metrics::add("settings/droppedPathsUnsaved");
+        s.setValue("droppedfiles", settings.droppedFiles.toList());
+        s.remove("droppedpaths");
+    }
     s.setValue("webfields", settings.webFields);
     s.setValue("webindex", settings.webIndex);
     s.setValue("hours", settings.hr);
@@ -347,6 +731,7 @@ void Flow::storeSettings()
     s.setValue("bgcolor", settings.bgcolor.name());
     s.setValue("multiply", settings.multiply);
     s.setValue("scale", settings.scale);
+    s.setValue("mosaictiles", settings.mosaicTiles);
     s.setValue("weight", settings.weight);
     s.setValue("folder", settings.folder);
     s.setValue("initOnce", settings.initOnce);
@@ -354,6 +739,16 @@ void Flow::storeSettings()
     s.setValue("target", settings.target);
     s.setValue("xsetbg", settings.xsetbg);
     s.setValue("plasmadbus", settings.plasmaDBus);
+    s.setValue("nativerender", settings.nativeRender);
+    s.setValue("filter", settings.filter);
+    s.setValue("aligndeadline", settings.alignDeadline);
+    s.setValue("progressive", settings.progressive);
+    s.setValue("mirror", settings.mirror);
+    s.setValue("mirrorfrom", settings.mirrorFrom);
+    s.setValue("mirrorto", settings.mirrorTo);
+    s.setValue("mirrorrate", settings.mirrorRate);
+    s.setValue("mirrorquota", settings.mirrorQuota);
+    s.setValue("overlays", settings.overlays);
     s.sync();
 }
 
@@ -364,7 +759,16 @@ void Flow::fetchSettings()
     settings.image = s.value("image").toString();
     settings.listfile = s.value("listfile").toString();
     settings.fileFolder = s.value("filefolder").toString();
-    settings.droppedFiles = s.value("droppedfiles").toStringList();
+    settings.archive = s.value("archive").toString();
+    settings.mix = s.value("mix").toString();
+    if (s.contains("droppedpaths")) {
+        settings.droppedFiles = PathStore::load(configFolderPath
+                                                + s.value("droppedpaths").toString());
+        storedDroppedFiles = settings.droppedFiles;
+    } else {
+        // settings from before the paths file
+        settings.droppedFiles = PathStore(s.value("droppedfiles").toStringList());
+    }
     settings.webFields = s.value("webfields").toStringList();
     settings.webIndex = s.value("webindex").toInt();
     settings.hr = s.value("hours").toInt();
@@ -373,6 +777,7 @@ void Flow::fetchSettings()
     settings.bgcolor.setNamedColor(s.value("bgcolor", "#303030").toString());
     settings.multiply = s.value("multiply", true).toBool();
     settings.scale = static_cast<Scaling>(s.value("scale",ScaledProportions).toInt());
+    settings.mosaicTiles = s.value("mosaictiles", 12).toInt();
     settings.weight = static_cast<Gravity>(s.value("weight", SouthEast).toInt());
     settings.folder = static_cast<Folder>(s.value("folder", ShmFolder).toInt());
     settings.initOnce = s.value("initOnce", true).toBool();
@@ -380,43 +785,121 @@ void Flow::fetchSettings()
     settings.target = s.value("target", QSize(1920,1080)).toSize();
     settings.xsetbg = s.value("xsetbg", false).toBool();
     settings.plasmaDBus = s.value("plasmadbus", true).toBool();
+    settings.nativeRender = s.value("nativerender", false).toBool();
+    settings.filter = static_cast<Filter>(s.value("filter", AutomaticFilter).toInt());
+    settings.alignDeadline = s.value("aligndeadline", false).toBool();
+    settings.progressive = s.value("progressive", false).toBool();
+    settings.mirror = s.value("mirror", false).toBool();
+    settings.mirrorFrom = s.value("mirrorfrom", 1).toInt();
+    settings.mirrorTo = s.value("mirrorto", 6).toInt();
+    settings.mirrorRate = s.value("mirrorrate", 512).toInt();
+    settings.mirrorQuota = s.value("mirrorquota", 2048).toInt();
+    settings.overlays = s.value("overlays").toStringList();
+}
+
+void Flow::userRequest(bool sameImage)
+{
+    // asked for now, so not held back for a deadline
+    abandonScheduled();
+    if (sameImage && !requestingSource) {
+        cancelPending();
+        item = activeSourceFilename;
+        if (changeOneWall())
+            return;
+    }
+    requestNextImage();
+}
+
+void Flow::abandonScheduled()
+{
+    // neither the frame being made for the next deadline nor one already
+    // waiting for it may replace what the user asked for
+    scheduledRequest = false;
+    scheduler->abandon();
+    if (!pendingFrame.isNull() || unlockReady) {
+        unlockReady = false;
+        pendingFrame = QImage();
+        QFile::remove(pendingImageName);
+    }
+}
+
+void Flow::cancelPending()
+{
+    renderGeneration.ref();
+    bool busy = requestingSource || previewPending
+            || converter->state() != QProcess::NotRunning
+            || renderWatcher->isRunning();
+    if (requestingSource && activeSource)
+        activeSource->cancel();
+    requestingSource = false;
+    previewPending = false;
+    if (converter->state() != QProcess::NotRunning) {
+        converter->blockSignals(true);
+        converter->kill();
+        converter->waitForFinished();
+        converter->blockSignals(false);
+    }
+    if (busy)
+        Metrics::add("render/cancelled");
 }
 
 void Flow::requestNextImage()
 {
-    if (requestingSource)
-        return;
+    // the newest request wins over whatever is still being fetched or rendered
+    cancelPending();
+
+    activeSource = selectedSource();
+    if (activeSource) {
+        requestingSource = true;
+        activeSource->fetchFile();
+    }
+}
 
-    timer->stop();
-    activeSource = nullptr;
+Sources::FileSource *Flow::selectedSource()
+{
     switch (settings.source) {
     case ImageSource:
-        activeSource = fileSource;
-        break;
+        return fileSource;
     case ListSource:
-        activeSource = fileListSource;
-        break;
+        return fileListSource;
     case FolderSource:
-        activeSource = folderSource;
-        break;
+        return folderSource;
     case DropSource:
-        activeSource = dropSource;
-        break;
+        return dropSource;
     case WebSource:
-        activeSource = webSources[settings.webIndex];
-        break;
-    }
-    if (activeSource) {
-        requestingSource = true;
-        activeSource->fetchFile();
+        return webSources.value(settings.webIndex);
+    case ArchiveSource:
+        return archiveSource;
+    case MixSource:
+        return mixSource;
     }
+    return nullptr;
+}
+
+QList<Sources::FileListSource*> Flow::librarySources()
+{
+    // the sources whose files are all known up front
+    QList<Sources::FileSource*> sources;
+    if (settings.source == MixSource)
+        sources = mixSource->sources();
+    else
+        sources.append(selectedSource());
+    QList<Sources::FileListSource*> library;
+    for (auto source : sources)
+        if (auto list = qobject_cast<Sources::FileListSource*>(source))
+            library.append(list);
+    return library;
 }
 
 void Flow::updateTimerInterval()
 {
-    timer->stop();
-    if (settings.running) {
-        timer->start(std::max(10000, (settings.hr*3600000) + (settings.mn*60000) + (settings.sc*1000)));
+    int interval = powerWatch->interval(std::max<qint64>(10000,
+            qint64(settings.hr)*3600000 + settings.mn*60000 + settings.sc*1000));
+    if (settings.running && !powerWatch->screenLocked()) {
+        scheduler->start(interval, settings.alignDeadline);
+    } else {
+        scheduler->stop();
+        scheduledRequest = false;
     }
 }
 
@@ -427,33 +910,36 @@ void Flow::updateDestFolder()
         destfolder = configFolderPath;
         break;
     case ShmFolder:
-        destfolder = workingDirNameShm;
+        destfolder = workingDirShm;
         break;
     case TmpFolder:
     default:
-        destfolder = workingDirNameTmp;
+        destfolder = workingDirTmp;
     }
     destfolder += '/';
 }
 
-void Flow::updateTargetString()
-{
-    targetString = QString("%1x%2").arg(settings.target.width())
-            .arg(settings.target.height());
-}
-
 void Flow::updateEnabled()
 {
     if (enableAction)
         enableAction->setChecked(settings.running);
 }
 
-void Flow::updateSources()
+void Flow::updateOverlays()
+{
+    // render jobs still running keep the stack they started with
+    overlays.reset(new OverlayStack(settings.overlays));
+}
+
+void Flow::updateSources(bool newSources)
 {
+    FramePool::instance()->setTarget(settings.target);
     fileSource->setPath(settings.image);
     fileListSource->setPath(settings.listfile);
     folderSource->setPath(settings.fileFolder);
     dropSource->setFiles(settings.droppedFiles);
+    archiveSource->setWorkFolder(destfolder);
+    archiveSource->setPath(settings.archive);
 
     int i = 0;
     for (auto &tags : settings.webFields) {
@@ -463,88 +949,210 @@ void Flow::updateSources()
         }
         i++;
     }
+    // only the web source picked in the dialog is mirrored
+    for (i = 0; i < webSources.count(); i++)
+        webSources[i]->mirror()->configure(configFolderPath + mirrorFolderName,
+                settings.mirror && i == settings.webIndex,
+                settings.mirrorFrom, settings.mirrorTo,
+                settings.mirrorRate, settings.mirrorQuota);
+    updateMix(newSources);
+    updateIndex();
+}
+
+void Flow::updateMix(bool newSources)
+{
+    // name=weight pairs, by the sources' short names; web is the web
+    // source picked in the dialog.  Setting them drops the queues, so
+    // only done when the mix or its sources changed.
+    if (!newSources)
+        return;
+    QList<Sources::FileSource*> mixed;
+    QList<int> weights;
+    if (settings.source == MixSource) {
+        QList<Sources::FileSource*> all { fileSource, fileListSource,
+                    folderSource, dropSource, archiveSource };
+        for (auto web : webSources)
+            all.append(web);
+        for (const QString &entry : settings.mix.split(QRegExp("[\\s,]+"),
+                                                       skipEmptyParts)) {
+            QString name = entry.section('=', 0, 0).toLower();
+            int weight = entry.section('=', 1).toInt();
+            Sources::FileSource *source = nullptr;
+            if (name == "web")
+                source = webSources.value(settings.webIndex);
+            for (auto s : all)
+                if (!source && s->shortName().toLower() == name)
+                    source = s;
+            if (source && weight > 0 && !mixed.contains(source)) {
+                mixed.append(source);
+                weights.append(weight);
+            }
+        }
+    }
+    mixSource->setSources(mixed, weights);
+}
+
+void Flow::updateIndex()
+{
+    // hash the library being shown in the background, so duplicates are
+    // known by the time they come up; left running while the library is
+    // the same
+    QList<PathStore> library;
+    for (auto list : librarySources())
+        library.append(list->files());
+    if (library == indexedFiles)
+        return;
+    indexedFiles = library;
+    QStringList files;
+    for (const PathStore &paths : library)
+        files.append(paths.toList());
+    int generation = indexGeneration.fetchAndAddOrdered(1) + 1;
+    for (int i = 0; i < files.count(); i += indexChunk) {
+        QStringList chunk = files.mid(i, indexChunk);
+        QtConcurrent::run(&indexPool, [chunk, generation]() {
+            Priority::makeIdle();
+            for (const QString &file : chunk) {
+                if (generation != indexGeneration.load())
+                    return;
+                Catalog::instance()->imageHash(file);
+            }
+        });
+    }
 }
 
-void Flow::changeOneWall()
+bool Flow::changeOneWall()
 {
     QString srcfname = item;
     QFileInfo inspector(srcfname);
     if (!inspector.isReadable() || !inspector.isFile())
-        return;
+        return false;
+    // the same mosaic again when only its look changes; a new tile count is
+    // a new mosaic
+    if (settings.scale == Mosaic
+            && (srcfname != activeSourceFilename || mosaicFiles.isEmpty()
+                || mosaicTiles != settings.mosaicTiles)) {
+        mosaicTiles = settings.mosaicTiles;
+        mosaicFiles.clear();
+        mosaicUnpack = std::function<void()>();
+        if (activeSource) {
+            mosaicFiles = activeSource->sample(settings.mosaicTiles - 1);
+            mosaicUnpack = activeSource->takeSampleJob();
+        }
+        mosaicFiles.removeAll(srcfname);
+        mosaicFiles.prepend(srcfname);
+    }
     activeSourceFilename = srcfname;
-    QString rs(targetString);
-    rs.append("^");
-    QString rs2(targetString);
-    rs2.append("+0+0");
-    // convert to linear space
-    QStringList args;
-    args << activeSourceFilename << "-colorspace" << "RGB";
-    switch (settings.scale) {
-    case ScaledProportions:
-        // scale to fit
-        args << "-resize" << targetString
-             << "-size" << targetString
-             << "-gravity" << dialogdata::gravityStrings[settings.weight];
-        break;
-    case ScaledCropped:
-        // scale to cover
-        args << "-resize" << rs
-             << "-gravity" << "center"
-             << "-crop" << rs2
-             << "-write" << "mpr:src" << "+delete"
-             << "-background" << "rgba(255,255,255)"
-             << "-size" << targetString
-             << "mpr:src";
-        break;
-    case TiledNotScaled:
-        // tile oversize for screen, then crop  (fairly expensive tbh)
-        args << "-write" << "mpr:src" << "+delete"
-             << "-background" << "rgba(0,0,0,0)"
-             << "-size" << calcTileSize(srcfname)
-             << "tile:mpr:src"
-             << "-gravity" << dialogdata::gravityStrings[settings.weight]
-             << "-size" << targetString;
-        break;
-    case NotScaled:
-    default:
-        // place at corner
-        args << "-size" << targetString
-             << "-gravity" << dialogdata::gravityStrings[settings.weight];
+    Render::Params params(settings);
+    watchedGeneration = renderGeneration.load();
+    // only asked-for images are worth a preview; the scheduler and the
+    // unlock hold theirs back anyway
+    if (settings.progressive && !scheduledRequest && !unlockRequest)
+        startPreview(srcfname, params);
+    // convert has no mosaic mode, and would decode huge sources whole
+    bool native = settings.nativeRender || settings.scale == Mosaic
+            || Render::isHugeSource(Catalog::instance()->imageSize(srcfname),
+                                    params);
+    // mosaics are sampled afresh each time, so they are not worth caching
+    renderKey = settings.scale == Mosaic ? QString()
+            : RenderCache::key(srcfname, params, native);
+    bool cached = RenderCache::contains(renderKey);
+    // an Automatic crop is keyed by its subject, found by the render job
+    bool keyLater = settings.scale != Mosaic && renderKey.isEmpty();
+    // convert crops around the subject the catalog knows; one it does not
+    // know yet is found on the render thread rather than here
+    QPointF focus;
+    bool findFocus = !native && settings.scale == ScaledCropped
+            && settings.weight == Automatic
+            && !Catalog::instance()->knownFocus(srcfname, &focus);
+    convertFallback = !native && (cached || findFocus);
+    if (native || cached || findFocus) {
+        std::function<QImage()> draw;
+        if (settings.scale == Mosaic) {
+            QStringList files = mosaicFiles;
+            std::function<void()> unpack = mosaicUnpack;
+            draw = [files, params, unpack]() {
+                // archive entries are only inflated here, off the GUI thread
+                if (unpack)
+                    unpack();
+                return Render::renderMosaic(files, params);
+            };
+        } else {
+            QSharedPointer<Render::Engine> renderer = engine;
+            draw = [srcfname, params, renderer]() {
+                return renderer->render(srcfname, params);
+            };
+        }
+        QSharedPointer<OverlayStack> stack = overlays;
+        QString key = renderKey;
+        QSize target = params.target;
+        int generation = watchedGeneration;
+        QDateTime shownAt = publishTime();
+        renderWatcher->setFuture(QtConcurrent::run(&renderPool,
+                [draw, native, key, target, stack, generation, findFocus,
+                 srcfname, params, keyLater, shownAt]() mutable {
+            if (generation != renderGeneration.load())
+                return QImage();
+            Priority::makeIdle();
+            if (findFocus)
+                Catalog::instance()->cropFocus(srcfname);
+            if (keyLater)
+                key = RenderCache::key(srcfname, params, native);
+            // another session may have made it already
+            QImage wall = RenderCache::lookup(key, target);
+            if (wall.isNull() && native) {
+                wall = draw();
+                if (keyLater)
+                    key = RenderCache::key(srcfname, params, native);
+                RenderCache::store(key, wall);
+            }
+            if (generation != renderGeneration.load())
+                return QImage();
+            stack->apply(wall, shownAt);
+            return !wall.isNull() && wall.save(tempImageName) ? wall : QImage();
+        }));
+        return true;
     }
-    // convert to monitor space
-    args << "-colorspace" << "sRGB";
-    if (settings.multiply)      // dither before multiply to reduce banding
-        args << "-ordered-dither" << QString("8x8,%1,%1,%1").arg(
-                    std::max(std::max(settings.bgcolor.red(),
-                                      settings.bgcolor.blue()),
-                             settings.bgcolor.green()));
-    // create background
-    args << QString("xc:%1").arg(settings.bgcolor.name()) << "+swap";
-    if (settings.multiply)      // apply screen
-        args << "-compose" << "multiply";
-    // make wall
-    args << "-composite" << "/dev/shm/qt314wall-tempimage.png";
-    converter->setEnvironment(QProcess::systemEnvironment() << "MAGICK_OCL_DEVICE=OFF");
-    converter->start("convert", args);
+    startConvert(params);
+    return true;
 }
 
-QString Flow::calcTileSize(const QString &srcfname)
+QDateTime Flow::publishTime()
 {
-    QProcess p;
-    p.start("identify", QStringList() << "-format" << "%w\t%h" << srcfname);
-    p.waitForFinished();
-    QStringList qsl = QString::fromUtf8(p.readLine()).trimmed().split("\t");
-    if (qsl.count() < 2) {
-        return targetString;
-    }
-    int w = qsl.at(0).toInt();
-    int h = qsl.at(1).toInt();
-
-    int tx = ((settings.target.width() / w) + 1) | 1;
-    int ty = ((settings.target.height() / h) + 1) | 1;
+    // a scheduled frame goes up at the deadline, others as soon as done;
+    // when the screen will be unlocked nobody knows
+    return scheduledRequest ? scheduler->nextDeadline() : QDateTime();
+}
 
-    int ox = w*tx;
-    int oy = h*ty;
+void Flow::startConvert(const Render::Params &params)
+{
+    QStringList args = Render::convertArguments(activeSourceFilename,
+                                                tempImageName, params);
+    converter->setEnvironment(QProcess::systemEnvironment() << "MAGICK_OCL_DEVICE=OFF");
+    converter->start("convert", args);
+}
 
-    return QString("%1x%2").arg(ox).arg(oy);
+void Flow::startPreview(const QString &srcfname, const Render::Params &params)
+{
+    QSharedPointer<OverlayStack> stack = overlays;
+    int generation = watchedGeneration;
+    // the budget counts from the request, waiting for the pool included
+    QElapsedTimer timer;
+    timer.start();
+    previewPending = true;
+    previewWatcher->setFuture(QtConcurrent::run(&previewPool,
+            [srcfname, params, stack, generation, timer]() {
+        if (generation != renderGeneration.load())
+            return QImage();
+        QImage wall = Render::renderPreview(srcfname, params);
+        stack->apply(wall);
+        Metrics::set("render/lastPreviewMs", timer.elapsed());
+        // too late to feel immediate, the full render is not far behind
+        if (timer.elapsed() > previewBudgetMs) {
+            Metrics::add("render/previewsOverBudget");
+            return QImage();
+        }
+        // stored uncompressed, it only lives until the full render is done
+        bool ok = !wall.isNull() && wall.save(previewImageName, "PNG", 100);
+        return ok ? wall : QImage();
+    }));
 }
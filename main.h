@@ -6,11 +6,21 @@
 #include <QMenu>
 #include <QSettings>
 #include <QLockFile>
-#include <QTimer>
 #include <QProcess>
+#include <QTimer>
+#include <QFutureWatcher>
+#include <QThreadPool>
+#include <QSharedPointer>
 #include <ext/random>
+#include <functional>
 #include "mainwindow.h"
 #include "source.h"
+#include "scheduler.h"
+#include "powerwatch.h"
+#include "overlay.h"
+#include "render.h"
+#include "filecheck.h"
+#include "librarybrowser.h"
 
 class Flow : public QObject {
     Q_OBJECT
@@ -29,52 +39,103 @@ private slots:
     void openImage_triggered();
     void openSource_triggered();
     void nextImage_triggered();
+    void library_triggered();
+    void library_fileActivated(const QString &fileName);
     void dialogDataChanged(const dialogdata &d);
     void source_nextFile(QString file);
     void changeWall();
     void changeWallConvertFinished(int exitCode);
+    void scheduler_prepare();
+    void scheduler_publish();
+    void power_changed();
+    void fileCheck_found(const QStringList &files);
+    void fileCheck_finished(const QStringList &files);
 
 private:
     MainWindow *window;
+    LibraryBrowser *browser;
     QSystemTrayIcon *sysicon;
     QLocalServer server;
     QMenu *ctxmenu;
-    QTimer *timer;
+    Scheduler *scheduler;
+    QTimer *idleTimer;
+    PowerWatch *powerWatch;
+    FileCheck *fileCheck;
     QProcess *converter;
+    QFutureWatcher<QImage> *renderWatcher;
+    QFutureWatcher<QImage> *previewWatcher;
+    QThreadPool renderPool;
+    QThreadPool previewPool;
+    QThreadPool indexPool;
+    QSharedPointer<Render::Engine> engine;
+    QSharedPointer<OverlayStack> overlays;
     QAction *enableAction;
     dialogdata settings;
     QString item;
     QString destfolder;
-    QString targetString;
     QString generatedFilename;
     QString activeSourceFilename;
+    QString renderKey;
+    QStringList mosaicFiles;
+    std::function<void()> mosaicUnpack;    // what sampling left to do
+    PathStore storedDroppedFiles;
+    QList<PathStore> indexedFiles;  // the library updateIndex last queued
+    QImage pendingFrame;
     std::random_device rseed;
     std::mt19937 rgen;
+    QTimer *coalesceTimer;
+    int watchedGeneration;
+    QList<quint64> recentHashes;
 
     bool requestingSource;
+    bool scheduledRequest;
+    bool unlockRequest;
+    bool unlockReady;
+    bool previewPending;
+    bool coalescedRequest;
+    bool fileCheckApplied;
+    bool startupRequest;
+    bool convertFallback;
+    int duplicateSkips;
+    int mosaicTiles;        // what mosaicFiles was sampled for
     Sources::FileSource *activeSource;
     Sources::FileSource *fileSource;
     Sources::FileListSource *fileListSource;
     Sources::FolderSource *folderSource;
     Sources::DropSource *dropSource;
+    Sources::ArchiveSource *archiveSource;
+    Sources::MixSource *mixSource;
     QList<Sources::WebSource*> webSources;
 
     void setupSysicon();
     void setupSources();
     void setupServer();
-    bool maybeSetToFiles(const QStringList &candidates, const QString &workingFolder = QString());
+    void checkFiles(const QStringList &candidates, const QString &workingFolder);
     void storeSettings();
     void fetchSettings();
 
+    void userRequest(bool sameImage = false);
+    void abandonScheduled();
+    void cancelPending();
     void requestNextImage();
+    Sources::FileSource *selectedSource();
+    QList<Sources::FileListSource*> librarySources();
     void updateTimerInterval();
     void updateDestFolder();
-    void updateTargetString();
     void updateEnabled();
-    void updateSources();
-    void changeOneWall();
-
-    QString calcTileSize(const QString &srcfname);
+    void updateSources(bool newSources = true);
+    void updateMix(bool newSources);
+    void updateIndex();
+    void updateOverlays();
+    bool changeOneWall();
+    void startConvert(const Render::Params &params);
+    QDateTime publishTime();
+    void startPreview(const QString &srcfname, const Render::Params &params);
+    void renderFinished(bool ok, const QImage &frame = QImage());
+    void previewFinished(const QImage &frame);
+    void renderFailed();
+    void publishWall(const QString &renderedFile, const QImage &frame,
+                     bool preview = false);
 };
 
 
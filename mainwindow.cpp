@@ -9,11 +9,7 @@
 #include <QSystemTrayIcon>
 #include <QDialogButtonBox>
 #include "source.h"
-
-const char *dialogdata::gravityStrings[] = {
-    "north", "northeast", "east", "southeast", "south", "southwest", "west",
-    "northwest", "center"
-};
+#include "qtcompat.h"
 
 MainWindow::MainWindow(QWidget *parent) :
     QWidget(parent),
@@ -21,6 +17,20 @@ MainWindow::MainWindow(QWidget *parent) :
 {
     ui->setupUi(this);
     setupSources();
+    // dropped piles are checked in the background and listed as they come
+    dropCheck = new FileCheck(this);
+    connect(dropCheck, &FileCheck::found,
+            this, [this](const QStringList &files) {
+        droppedSoFar.append(files);
+        ui->sourceDrop->setChecked(true);
+        updateDropLabel(droppedSoFar.count(), true);
+    });
+    connect(dropCheck, &FileCheck::finished,
+            this, [this](const QStringList &files) {
+        if (!files.isEmpty())
+            lastDroppedFiles = PathStore(files);
+        updateDropLabel(lastDroppedFiles.count());
+    });
     if (!QSystemTrayIcon::isSystemTrayAvailable()) {
         auto cancel = ui->buttonBox->button(QDialogButtonBox::Cancel);
         ui->buttonBox->removeButton(cancel);
@@ -62,10 +72,16 @@ void MainWindow::setData(const dialogdata &d)
     ui->sourceFolder->setChecked(d.source == FolderSource);
     ui->sourceDrop->setChecked(d.source == DropSource);
     ui->sourceWeb->setChecked(d.source == WebSource);
+    ui->sourceArchive->setChecked(d.source == ArchiveSource);
+    ui->sourceMix->setChecked(d.source == MixSource);
     ui->image->setText(d.image);
     ui->listfile->setText(d.listfile);
     ui->fileFolder->setText(d.fileFolder);
+    ui->archive->setText(d.archive);
+    ui->mix->setText(d.mix);
     lastDroppedFiles = d.droppedFiles;
+    if (!dropCheck->isRunning())
+        updateDropLabel(lastDroppedFiles.count());
     for (int i = 0; i < webFields.count(); i++) {
         webFields[i] = d.webFields.value(i);
         webFieldWidgets[i]->setText(d.webFields.value(i));
@@ -77,6 +93,7 @@ void MainWindow::setData(const dialogdata &d)
     ui->bgcolor->setText(d.bgcolor.name());
     ui->multiply->setChecked(d.multiply);
     ui->scale->setCurrentIndex(d.scale);
+    ui->mosaicTiles->setValue(d.mosaicTiles);
     ui->gravity->setCurrentIndex(d.weight);
     ui->folder->setCurrentIndex(d.folder);
     ui->targetWidth->setValue(d.target.width());
@@ -85,6 +102,16 @@ void MainWindow::setData(const dialogdata &d)
     ui->running->setChecked(d.running);
     ui->xsetbg->setChecked(d.xsetbg);
     ui->plasmaDBus->setChecked(d.plasmaDBus);
+    ui->nativeRender->setChecked(d.nativeRender);
+    ui->filter->setCurrentIndex(d.filter);
+    ui->alignDeadline->setChecked(d.alignDeadline);
+    ui->progressive->setChecked(d.progressive);
+    ui->mirror->setChecked(d.mirror);
+    ui->mirrorFrom->setValue(d.mirrorFrom);
+    ui->mirrorTo->setValue(d.mirrorTo);
+    ui->mirrorRate->setValue(d.mirrorRate);
+    ui->mirrorQuota->setValue(d.mirrorQuota);
+    ui->overlays->setPlainText(d.overlays.join('\n'));
     updateBgcolorWidgetSheet();
 }
 
@@ -104,12 +131,26 @@ void MainWindow::dropEvent(QDropEvent *event)
     if (!event->mimeData()->hasUrls())
         return;
 
-    lastDroppedFiles.clear();
+    QStringList files;
     for (const QUrl &url : event->mimeData()->urls()) {
         if (url.isLocalFile())
-            lastDroppedFiles.append(url.toLocalFile());
+            files.append(url.toLocalFile());
     }
-    ui->sourceDrop->setChecked(true);
+    if (files.isEmpty())
+        return;
+    droppedSoFar.clear();
+    dropCheck->start(files);
+    updateDropLabel(0, true);
+}
+
+void MainWindow::updateDropLabel(int count, bool checking)
+{
+    if (checking)
+        ui->label->setText(tr("Checking... %n image(s)", nullptr, count));
+    else if (count)
+        ui->label->setText(tr("%n image(s), drop items to replace", nullptr, count));
+    else
+        ui->label->setText(tr("Drop items here"));
 }
 
 void MainWindow::setupSources()
@@ -127,7 +168,9 @@ void MainWindow::setupSources()
         { tr("Open Text File"), QFileDialog::ExistingFile,
             ui->listfile, ui->listfileBrowse },
         { tr("Open Folder"), QFileDialog::Directory,
-            ui->fileFolder, ui->fileFolderBrowse }
+            ui->fileFolder, ui->fileFolderBrowse },
+        { tr("Open Archive"), QFileDialog::ExistingFile,
+            ui->archive, ui->archiveBrowse }
     };
 
     for (auto &s : fileSources) {
@@ -155,12 +198,18 @@ void MainWindow::on_buttonBox_clicked(QAbstractButton *button)
         d.source = ui->sourceImage->isChecked() ? ImageSource :
                    ui->sourceImageList->isChecked() ? ListSource :
                    ui->sourceFolder->isChecked() ? FolderSource :
-                   ui->sourceDrop->isChecked() ? DropSource
-                                               : WebSource;
+                   ui->sourceDrop->isChecked() ? DropSource :
+                   ui->sourceArchive->isChecked() ? ArchiveSource :
+                   ui->sourceMix->isChecked() ? MixSource
+                                              : WebSource;
         d.image = ui->image->text();
         d.listfile = ui->listfile->text();
         d.fileFolder = ui->fileFolder->text();
-        d.droppedFiles = lastDroppedFiles;
+        d.archive = ui->archive->text();
+        d.mix = ui->mix->text();
+        // applying mid-check takes what has been found so far
+        d.droppedFiles = dropCheck->isRunning() ? PathStore(droppedSoFar)
+                                                : lastDroppedFiles;
         d.webFields = webFields;
         d.webIndex = ui->webSource->currentIndex();
         d.hr = ui->hrs->value();
@@ -169,6 +218,7 @@ void MainWindow::on_buttonBox_clicked(QAbstractButton *button)
         d.bgcolor = ui->bgcolor->text();
         d.multiply = ui->multiply->isChecked();
         d.scale = static_cast<Scaling>(ui->scale->currentIndex());
+        d.mosaicTiles = ui->mosaicTiles->value();
         d.weight = static_cast<Gravity>(ui->gravity->currentIndex());
         d.folder = static_cast<Folder>(ui->folder->currentIndex());
         d.initOnce = ui->initOnce->isChecked();
@@ -176,6 +226,16 @@ void MainWindow::on_buttonBox_clicked(QAbstractButton *button)
         d.target = QSize(ui->targetWidth->value(), ui->targetHeight->value());
         d.xsetbg = ui->xsetbg->isChecked();
         d.plasmaDBus = ui->plasmaDBus->isChecked();
+        d.nativeRender = ui->nativeRender->isChecked();
+        d.filter = static_cast<Filter>(ui->filter->currentIndex());
+        d.alignDeadline = ui->alignDeadline->isChecked();
+        d.progressive = ui->progressive->isChecked();
+        d.mirror = ui->mirror->isChecked();
+        d.mirrorFrom = ui->mirrorFrom->value();
+        d.mirrorTo = ui->mirrorTo->value();
+        d.mirrorRate = ui->mirrorRate->value();
+        d.mirrorQuota = ui->mirrorQuota->value();
+        d.overlays = ui->overlays->toPlainText().split('\n', skipEmptyParts);
         emit dataChanged(d);
     }
     if (br == QDialogButtonBox::AcceptRole || br == QDialogButtonBox::RejectRole) {
@@ -228,3 +288,8 @@ void MainWindow::on_webSource_currentIndexChanged(int index)
 {
     ui->webSourcePages->setCurrentIndex(index);
 }
+
+void MainWindow::on_libraryBrowse_clicked()
+{
+    emit libraryRequested();
+}
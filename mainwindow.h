@@ -5,37 +5,8 @@
 #include <QAbstractButton>
 #include <QLineEdit>
 #include "source.h"
-
-enum Source { ImageSource, ListSource, FolderSource, DropSource, WebSource };
-enum Scaling { ScaledProportions, ScaledCropped, TiledNotScaled, NotScaled };
-enum Gravity { North, NorthEast, East, SouthEast, South, SouthWest, West,
-               NorthWest, Center };
-enum Folder { ConfigFolder, ShmFolder, TmpFolder };
-
-struct dialogdata {
-    Source source;
-    QString image;
-    QString listfile;
-    QString fileFolder;
-    QStringList droppedFiles;
-    QStringList webFields;
-    int webIndex;
-    int hr, mn, sc;
-    QColor bgcolor;
-    bool multiply;
-    Scaling scale;
-    Gravity weight;
-    QSize target;
-    Folder folder;
-    bool initOnce;
-    bool running;
-    bool xsetbg;
-    bool plasmaDBus;
-
-    dialogdata() : listfile(), hr(0), mn(0), sc(10), bgcolor(48,48,48),
-        multiply(true), scale(ScaledProportions), weight(SouthEast) { }
-    static const char *gravityStrings[];
-};
+#include "dialogdata.h"
+#include "filecheck.h"
 
 namespace Ui {
 class MainWindow;
@@ -54,6 +25,7 @@ public:
 
 signals:
     void dataChanged(const dialogdata &d);
+    void libraryRequested();
 
 protected:
     void dragEnterEvent(QDragEnterEvent *event);
@@ -61,6 +33,7 @@ protected:
 
 private:
     void setupSources();
+    void updateDropLabel(int count, bool checking = false);
 
 private slots:
 
@@ -76,10 +49,14 @@ private slots:
 
     void on_webSource_currentIndexChanged(int index);
 
+    void on_libraryBrowse_clicked();
+
 private:
     Ui::MainWindow *ui;
     void updateBgcolorWidgetSheet();
-    QStringList lastDroppedFiles;
+    PathStore lastDroppedFiles;
+    FileCheck *dropCheck;
+    QStringList droppedSoFar;
     QStringList webFields;
     QList<QLineEdit*> webFieldWidgets;
 };
@@ -0,0 +1,38 @@
+#include "metrics.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSaveFile>
+
+static QMutex mutex;
+static QVariantMap values;
+
+void Metrics::add(const QString &name, qint64 delta)
+{
+    QMutexLocker lock(&mutex);
+    values[name] = values.value(name).toLongLong() + delta;
+}
+
+void Metrics::set(const QString &name, const QVariant &value)
+{
+    QMutexLocker lock(&mutex);
+    values[name] = value;
+}
+
+QVariantMap Metrics::snapshot()
+{
+    QMutexLocker lock(&mutex);
+    return values;
+}
+
+bool Metrics::write(const QString &fileName)
+{
+    QByteArray json = QJsonDocument(QJsonObject::fromVariantMap(snapshot()))
+            .toJson();
+    QSaveFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly))
+        return false;
+    f.write(json);
+    return f.commit();
+}
@@ -0,0 +1,18 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QString>
+#include <QVariantMap>
+
+// Process-wide counters and gauges, written out as json for monitoring.
+// All functions are safe to call from render threads.
+namespace Metrics {
+
+void add(const QString &name, qint64 delta = 1);
+void set(const QString &name, const QVariant &value);
+QVariantMap snapshot();
+bool write(const QString &fileName);
+
+}
+
+#endif // METRICS_H
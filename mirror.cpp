@@ -0,0 +1,337 @@
+#include "mirror.h"
+#include "source.h"
+#include "metrics.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QSaveFile>
+#include <QUrlQuery>
+#include <algorithm>
+
+using namespace Sources;
+
+static const int postsPerPage = 100;
+// how often the hours and the schedule are looked at
+static const int tickInterval = 60000;
+// a query gone through to the end is looked at again after this long
+static const qint64 runInterval = 12 * 3600;
+static const char postsName[] = "posts.jsonl";
+static const char stateName[] = "state.json";
+
+WebMirror::WebMirror(WebSource *source)
+    : QObject(source)
+    , source(source)
+    , enabled(false)
+    , fromHour(0)
+    , toHour(0)
+    , rate(0)
+    , quota(0)
+    , bytes(0)
+    , running(false)
+    , runId(0)
+    , page(1)
+    , inProgress(false)
+    , caughtUp(false)
+    , runBytes(0)
+    , rgen(rseed())
+{
+    ticker = new QTimer(this);
+    ticker->setInterval(tickInterval);
+    connect(ticker, &QTimer::timeout, this, &WebMirror::tick);
+}
+
+void WebMirror::configure(const QString &root, bool enabled, int fromHour,
+                          int toHour, int rateKiB, int quotaMiB)
+{
+    this->enabled = enabled && !root.isEmpty();
+    this->fromHour = fromHour;
+    this->toHour = toHour;
+    rate = qint64(rateKiB) << 10;
+    quota = qint64(quotaMiB) << 20;
+
+    QString query = source->shortName() + ' ' + source->tags().join(' ');
+    QString name = QString("%1-%2").arg(source->shortName(),
+            QCryptographicHash::hash(query.toUtf8(),
+                                     QCryptographicHash::Sha1).toHex().left(12));
+    QString newFolder = this->enabled ? root + '/' + name : QString();
+    if (newFolder != folder) {
+        if (running)
+            stopRun();
+        folder = newFolder;
+        load();
+    }
+    if (!this->enabled) {
+        ticker->stop();
+        return;
+    }
+    ticker->start();
+    tick();
+}
+
+bool WebMirror::isEnabled() const
+{
+    return enabled;
+}
+
+QString WebMirror::pick()
+{
+    if (files.isEmpty())
+        return QString();
+    std::uniform_int_distribution<int> dist(0, files.count()-1);
+    return files.at(dist(rgen));
+}
+
+void WebMirror::tick()
+{
+    if (!enabled || folder.isEmpty())
+        return;
+    if (running) {
+        if (!inWindow())
+            stopRun();
+        return;
+    }
+    // an interrupted run carries on straight away, a finished one waits
+    if (!inWindow() || (!inProgress && finished.isValid()
+                        && finished.secsTo(QDateTime::currentDateTime()) < runInterval))
+        return;
+    startRun();
+}
+
+void WebMirror::load()
+{
+    known.clear();
+    files.clear();
+    bytes = 0;
+    page = 1;
+    inProgress = false;
+    caughtUp = false;
+    finished = QDateTime();
+    if (folder.isEmpty() || !QDir().mkpath(folder))
+        return;
+
+    QFile posts(folder + '/' + postsName);
+    if (posts.open(QIODevice::ReadOnly)) {
+        while (!posts.atEnd()) {
+            QJsonObject post = QJsonDocument::fromJson(posts.readLine()).object();
+            QFileInfo file(folder + '/' + post.value("file").toString());
+            qint64 id = qint64(post.value("id").toDouble());
+            // files deleted by hand can come back
+            if (!file.isFile() || known.contains(id))
+                continue;
+            known.insert(id);
+            files.append(file.filePath());
+            bytes += file.size();
+        }
+    }
+    QFile state(folder + '/' + stateName);
+    if (state.open(QIODevice::ReadOnly)) {
+        QJsonObject o = QJsonDocument::fromJson(state.readAll()).object();
+        page = std::max(1, o.value("page").toInt());
+        // state from before the flag: only past page 1 was it certain
+        inProgress = o.contains("inprogress") ? o.value("inprogress").toBool()
+                                              : page > 1;
+        caughtUp = o.value("caughtup").toBool();
+        finished = QDateTime::fromString(o.value("finished").toString(), Qt::ISODate);
+    }
+    Metrics::set("mirror/storedBytes", bytes);
+}
+
+void WebMirror::saveState()
+{
+    if (folder.isEmpty())
+        return;
+    QJsonObject o;
+    o.insert("page", page);
+    o.insert("inprogress", inProgress);
+    o.insert("caughtup", caughtUp);
+    o.insert("finished", finished.toString(Qt::ISODate));
+    QSaveFile state(folder + '/' + stateName);
+    if (state.open(QIODevice::WriteOnly)) {
+        state.write(QJsonDocument(o).toJson());
+        state.commit();
+    }
+}
+
+bool WebMirror::inWindow() const
+{
+    if (fromHour == toHour)
+        return true;
+    int hour = QTime::currentTime().hour();
+    return fromHour < toHour ? hour >= fromHour && hour < toHour
+                             : hour >= fromHour || hour < toHour;
+}
+
+void WebMirror::startRun()
+{
+    running = true;
+    inProgress = true;
+    runId++;
+    queue.clear();
+    runBytes = 0;
+    runTimer.start();
+    saveState();
+    Metrics::add("mirror/runs");
+    requestPage();
+}
+
+void WebMirror::stopRun()
+{
+    // the page reached is kept, to carry on from next time
+    if (pending)
+        pending->abort();
+    pending = nullptr;
+    running = false;
+    queue.clear();
+    saveState();
+}
+
+void WebMirror::finishRun(bool complete)
+{
+    running = false;
+    inProgress = false;
+    if (complete)
+        caughtUp = true;
+    page = 1;
+    finished = QDateTime::currentDateTime();
+    saveState();
+    Metrics::add("mirror/finished");
+}
+
+void WebMirror::paced(void (WebMirror::*step)())
+{
+    // wait until the run is back under the cap
+    qint64 delay = rate > 0 ? runBytes * 1000 / rate - runTimer.elapsed() : 0;
+    int id = runId;
+    QTimer::singleShot(int(std::max<qint64>(0, delay)), this, [this,step,id]() {
+        if (running && id == runId)
+            (this->*step)();
+    });
+}
+
+void WebMirror::requestPage()
+{
+    QUrlQuery query;
+    query.addQueryItem("limit", QString::number(postsPerPage));
+    query.addQueryItem("page", QString::number(page));
+    QNetworkReply *reply = qnam.get(source->apiRequest(query));
+    connect(reply, &QNetworkReply::finished,
+            this, [this,reply]() { page_finished(reply); });
+    pending = reply;
+}
+
+void WebMirror::page_finished(QNetworkReply *reply)
+{
+    reply->deleteLater();
+    if (reply->error() == QNetworkReply::OperationCanceledError)
+        return;
+    pending = nullptr;
+    if (reply->error() != QNetworkReply::NoError) {
+        // an outage; the next tick tries again from this page
+        Metrics::add("mirror/errors");
+        stopRun();
+        return;
+    }
+    QByteArray data = reply->readAll();
+    runBytes += data.size();
+    QVariantList posts = QJsonDocument::fromJson(data).toVariant().toList();
+    if (posts.isEmpty()) {
+        finishRun(true);
+        return;
+    }
+    for (const QVariant &item : posts) {
+        QVariantMap post = item.toMap();
+        QString fileUrl = post.value("file_url").toString();
+        if (fileUrl.isEmpty() || known.contains(post.value("id").toLongLong()))
+            continue;
+        post.insert("file_url", reply->url().resolved(QUrl(fileUrl)).toString());
+        queue.append(post);
+    }
+    // newest first, so once through, a page of old posts means the rest
+    // are old too
+    if (queue.isEmpty() && caughtUp) {
+        finishRun(true);
+        return;
+    }
+    paced(&WebMirror::nextPost);
+}
+
+void WebMirror::nextPost()
+{
+    if (queue.isEmpty()) {
+        page++;
+        saveState();
+        requestPage();
+        return;
+    }
+    QVariantMap post = queue.takeFirst();
+    if (bytes + post.value("file_size").toLongLong() > quota) {
+        Metrics::add("mirror/quotaReached");
+        finishRun(false);
+        return;
+    }
+    QNetworkRequest request(QUrl(post.value("file_url").toString()));
+    request.setHeader(QNetworkRequest::UserAgentHeader, WebSource::userAgent());
+    QNetworkReply *reply = qnam.get(request);
+    connect(reply, &QNetworkReply::finished,
+            this, [this,reply,post]() { post_finished(reply, post); });
+    pending = reply;
+}
+
+void WebMirror::post_finished(QNetworkReply *reply, const QVariantMap &post)
+{
+    reply->deleteLater();
+    if (reply->error() == QNetworkReply::OperationCanceledError)
+        return;
+    pending = nullptr;
+    if (reply->error() != QNetworkReply::NoError) {
+        Metrics::add("mirror/errors");
+        paced(&WebMirror::nextPost);
+        return;
+    }
+    QByteArray data = reply->readAll();
+    runBytes += data.size();
+    // posts without a file_size got past the check before the download
+    if (bytes + data.size() > quota) {
+        Metrics::add("mirror/quotaReached");
+        finishRun(false);
+        return;
+    }
+    qint64 id = post.value("id").toLongLong();
+    QString ext = QFileInfo(reply->url().path()).suffix().toLower();
+    QString name = QString("%1.%2").arg(id).arg(ext.isEmpty() ? "jpg" : ext);
+    QSaveFile file(folder + '/' + name);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()
+            || !file.commit()) {
+        // a full disk will not be better on the next post
+        Metrics::add("mirror/errors");
+        stopRun();
+        return;
+    }
+
+    QJsonObject meta;
+    meta.insert("id", id);
+    meta.insert("file", name);
+    meta.insert("bytes", data.size());
+    meta.insert("mirrored", QDateTime::currentDateTime().toString(Qt::ISODate));
+    for (const char *key : { "md5", "tags", "tag_string", "rating", "width",
+                             "height", "image_width", "image_height",
+                             "source", "file_url", "created_at" })
+        if (post.contains(key))
+            meta.insert(key, QJsonValue::fromVariant(post.value(key)));
+    QFile posts(folder + '/' + postsName);
+    if (posts.open(QIODevice::WriteOnly | QIODevice::Append))
+        posts.write(QJsonDocument(meta).toJson(QJsonDocument::Compact) + '\n');
+
+    known.insert(id);
+    files.append(file.fileName());
+    bytes += data.size();
+    Metrics::add("mirror/posts");
+    Metrics::add("mirror/bytes", data.size());
+    Metrics::set("mirror/storedBytes", bytes);
+    paced(&WebMirror::nextPost);
+}
@@ -0,0 +1,88 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <QVariantMap>
+#include <random>
+
+namespace Sources {
+
+class WebSource;
+
+// A local copy of a web source's tag query.  Within the allowed hours the
+// query is paged through with the API's own paging, newest posts first,
+// and every post not yet mirrored is downloaded into a folder of its own,
+// held to a bandwidth cap and a disk quota.  Each post gets a line in
+// posts.jsonl there; state.json keeps the page reached and whether the
+// run got to its end, so a run cut short by the hours, a quit, an outage
+// or a disk error carries on where it stopped.
+// Once a run has gone through every page, later ones stop at the first
+// page with nothing new on it.
+class WebMirror : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WebMirror(WebSource *source);
+    // root holds one folder per host and query.  fromHour == toHour means
+    // any time; rateKiB 0 means no cap.
+    void configure(const QString &root, bool enabled, int fromHour,
+                   int toHour, int rateKiB, int quotaMiB);
+    bool isEnabled() const;
+    // A mirrored post picked at random, empty when there is none.
+    QString pick();
+
+private:
+    void tick();
+    void load();
+    void saveState();
+    void startRun();
+    void stopRun();
+    void finishRun(bool complete);
+    void requestPage();
+    void page_finished(QNetworkReply *reply);
+    void nextPost();
+    void post_finished(QNetworkReply *reply, const QVariantMap &post);
+    void paced(void (WebMirror::*step)());
+    bool inWindow() const;
+
+    WebSource *source;
+    QNetworkAccessManager qnam;
+    QPointer<QNetworkReply> pending;
+    QTimer *ticker;
+    QString root;
+    QString folder;
+    bool enabled;
+    int fromHour, toHour;
+    qint64 rate;        // bytes per second, 0 for no cap
+    qint64 quota;       // bytes
+
+    // what is on disk
+    QSet<qint64> known;
+    QStringList files;
+    qint64 bytes;
+
+    // the run, and what state.json keeps of it
+    bool running;
+    int runId;          // tells a run's timers from an earlier one's
+    int page;
+    bool inProgress;    // a run was started and has not finished yet
+    bool caughtUp;      // some run has been through every page
+    QDateTime finished;
+    QList<QVariantMap> queue;
+    QElapsedTimer runTimer;
+    qint64 runBytes;
+
+    std::random_device rseed;
+    std::mt19937 rgen;
+};
+
+}
+
+#endif // MIRROR_H
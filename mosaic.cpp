@@ -0,0 +1,184 @@
+#include "mosaic.h"
+#include "catalog.h"
+#include "framepool.h"
+#include "metrics.h"
+#include "priority.h"
+
+#include <QImageReader>
+#include <QPainter>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace Render;
+
+// pixels of background between tiles
+static const int mosaicGap = 4;
+
+// Which row each image lands on for a given row count: rows split the
+// summed aspect ratios evenly, with each image going by its middle.
+static QVector<int> splitRows(const QVector<double> &aspects, double total,
+                              int rows)
+{
+    QVector<int> row(aspects.count());
+    double before = 0;
+    for (int i = 0; i < aspects.count(); i++) {
+        double middle = before + aspects[i] / 2;
+        row[i] = std::min(rows - 1, int(middle / total * rows));
+        before += aspects[i];
+    }
+    return row;
+}
+
+// Splits length into parts proportional to weights, gap apart, rounding
+// so the parts always add up exactly.
+static QVector<int> spread(const QVector<double> &weights, int length, int gap)
+{
+    QVector<int> edges(weights.count() + 1);
+    double sum = 0;
+    for (double w : weights)
+        sum += w;
+    int room = length - gap * (weights.count() - 1);
+    double run = 0;
+    for (int i = 0; i < weights.count(); i++) {
+        edges[i] = int(std::lround(run / sum * room)) + gap * i;
+        run += weights[i];
+    }
+    edges.last() = length + gap;
+    return edges;
+}
+
+QVector<QRect> Render::mosaicLayout(const QVector<QSize> &sizes,
+                                    const QSize &target, int gap)
+{
+    int n = sizes.count();
+    if (n == 0 || target.isEmpty())
+        return QVector<QRect>();
+    QVector<double> aspects(n);
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        aspects[i] = sizes[i].isEmpty() ? 1.0
+                : double(sizes[i].width()) / sizes[i].height();
+        total += aspects[i];
+    }
+
+    // try every row count and keep the one that needs the least stretching
+    QVector<int> best;
+    int bestRows = 0;
+    double bestScore = 0;
+    for (int rows = 1; rows <= n; rows++) {
+        QVector<int> row = splitRows(aspects, total, rows);
+        QVector<double> rowAspect(rows, 0.0);
+        QVector<int> rowCount(rows, 0);
+        for (int i = 0; i < n; i++) {
+            rowAspect[row[i]] += aspects[i];
+            rowCount[row[i]]++;
+        }
+        if (std::count(rowCount.begin(), rowCount.end(), 0))
+            continue;
+        double height = gap * (rows - 1);
+        for (int r = 0; r < rows; r++)
+            height += (target.width() - gap * (rowCount[r] - 1)) / rowAspect[r];
+        double score = std::abs(std::log(height / target.height()));
+        if (best.isEmpty() || score < bestScore) {
+            best = row;
+            bestRows = rows;
+            bestScore = score;
+        }
+    }
+
+    // row heights in proportion to their natural height, 1/aspect
+    QVector<double> heights(bestRows, 0.0);
+    QVector<int> counts(bestRows, 0);
+    for (int i = 0; i < n; i++) {
+        heights[best[i]] += aspects[i];
+        counts[best[i]]++;
+    }
+    for (int r = 0; r < bestRows; r++)
+        heights[r] = (target.width() - gap * (counts[r] - 1)) / heights[r];
+    QVector<int> ys = spread(heights, target.height(), gap);
+
+    QVector<QRect> rects(n);
+    for (int first = 0; first < n; ) {
+        int r = best[first];
+        int last = first + counts[r];
+        QVector<int> xs = spread(aspects.mid(first, counts[r]),
+                                 target.width(), gap);
+        for (int i = first; i < last; i++)
+            rects[i] = QRect(QPoint(xs[i - first], ys[r]),
+                             QPoint(xs[i - first + 1] - gap - 1,
+                                    ys[r + 1] - gap - 1));
+        first = last;
+    }
+    return rects;
+}
+
+// One cell: decoded near its size, scaled to cover it, centre-cropped and
+// composited on the background.  Tiles are small, so they are scaled in
+// sRGB by the decoder rather than in linear light.
+static QImage renderTile(const QString &fname, const QSize &full,
+                         const QSize &size, const Params &p)
+{
+    QSize cover = fitSize(full, size, true);
+    QImageReader reader(fname);
+    if (cover.width() < full.width())
+        reader.setScaledSize(cover);
+    QImage image;
+    if (!reader.read(&image))
+        return QImage();
+    if (image.size() != cover)
+        image = image.scaled(cover, Qt::IgnoreAspectRatio,
+                             Qt::SmoothTransformation);
+
+    QImage tile(size, QImage::Format_RGB32);
+    tile.fill(p.bgcolor);
+    QPainter painter(&tile);
+    painter.setCompositionMode(p.multiply ? QPainter::CompositionMode_Multiply
+                                          : QPainter::CompositionMode_SourceOver);
+    painter.drawImage(-gravityOffset(size, cover, Center), image);
+    return tile;
+}
+
+QImage Render::renderMosaic(const QStringList &files, const Params &p)
+{
+    struct Cell {
+        QString fname;
+        QSize full;
+        QRect rect;
+    };
+    QVector<Cell> cells;
+    QVector<QSize> sizes;
+    for (const QString &fname : files) {
+        QSize size = Catalog::instance()->imageSize(fname);
+        if (!size.isValid())
+            continue;
+        cells.append(Cell { fname, size, QRect() });
+        sizes.append(size);
+    }
+    if (cells.isEmpty() || p.target.isEmpty())
+        return QImage();
+    QVector<QRect> rects = mosaicLayout(sizes, p.target, mosaicGap);
+    for (int i = 0; i < cells.count(); i++)
+        cells[i].rect = rects[i];
+
+    QImage canvas = FramePool::instance()->acquire(p.target,
+                                                   QImage::Format_RGB32);
+    canvas.fill(p.bgcolor);
+    // cells do not overlap, so each job writes its own part of the canvas
+    uchar *bits = canvas.bits();
+    int bytesPerLine = canvas.bytesPerLine();
+    Priority::blockingMap(cells.count(), [&p, &cells, bits, bytesPerLine](int i) {
+        const Cell &cell = cells.at(i);
+        if (cell.rect.isEmpty())
+            return;
+        QImage tile = renderTile(cell.fname, cell.full, cell.rect.size(), p);
+        if (tile.isNull())
+            return;
+        for (int y = 0; y < tile.height(); y++)
+            memcpy(bits + (cell.rect.y() + y) * bytesPerLine + cell.rect.x() * 4,
+                   tile.constScanLine(y), size_t(tile.width()) * 4);
+    });
+    Metrics::add("render/mosaics");
+    Metrics::add("render/mosaicTiles", cells.count());
+    return canvas;
+}
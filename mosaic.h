@@ -0,0 +1,28 @@
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+#include <QImage>
+#include <QRect>
+#include <QStringList>
+#include <QVector>
+#include "render.h"
+
+namespace Render {
+
+// Justified rows: images keep their order and roughly their aspect, each
+// row spans the target width and the rows fill its height, with gap pixels
+// between them.  The row count is the one whose natural height comes
+// closest to the target, so tiles are only cropped a little to fit.
+QVector<QRect> mosaicLayout(const QVector<QSize> &sizes, const QSize &target,
+                            int gap);
+
+// A collage of files on the background colour.  It is planned from the
+// sizes in the catalog, then every tile is decoded already shrunk
+// (downscale-on-decode where the format allows it), cropped to its cell
+// and composited on its own idle thread (Priority::blockingMap).
+// Unreadable files are left out.
+QImage renderMosaic(const QStringList &files, const Params &p);
+
+}
+
+#endif // MOSAIC_H
@@ -0,0 +1,280 @@
+#include "overlay.h"
+#include "render.h"
+#include "qtcompat.h"
+
+#include <QDateTime>
+#include <QFont>
+#include <QFontMetrics>
+#include <QPainter>
+#include <QRadialGradient>
+#include <algorithm>
+#include <cmath>
+
+static const int defaultMargin = 32;
+static const int defaultTextSize = 48;
+
+// x/255, rounded, for x in 0..255*255
+static inline quint32 div255(quint32 x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Blend a premultiplied row onto an opaque row, one functor per mode so
+// the compiler can vectorize each inner loop on its own.
+struct BlendOver {
+    static inline quint32 channel(quint32 s, quint32 d, quint32 sa) {
+        return s + div255(d * (255 - sa));
+    }
+};
+struct BlendMultiply {
+    static inline quint32 channel(quint32 s, quint32 d, quint32 sa) {
+        return div255(s * d + d * (255 - sa));
+    }
+};
+struct BlendScreen {
+    static inline quint32 channel(quint32 s, quint32 d, quint32) {
+        return s + d - div255(s * d);
+    }
+};
+struct BlendAdd {
+    static inline quint32 channel(quint32 s, quint32 d, quint32) {
+        return std::min<quint32>(255, s + d);
+    }
+};
+
+template <class Op>
+static void blendRow(quint32 *dst, const quint32 *src, int count)
+{
+    for (int i = 0; i < count; i++) {
+        quint32 s = src[i], d = dst[i];
+        quint32 sa = s >> 24;
+        quint32 r = Op::channel((s >> 16) & 0xff, (d >> 16) & 0xff, sa);
+        quint32 g = Op::channel((s >> 8) & 0xff, (d >> 8) & 0xff, sa);
+        quint32 b = Op::channel(s & 0xff, d & 0xff, sa);
+        dst[i] = 0xff000000 | (r << 16) | (g << 8) | b;
+    }
+}
+
+static void blendRow(OverlayStack::Blend blend, quint32 *dst,
+                     const quint32 *src, int count)
+{
+    switch (blend) {
+    case OverlayStack::Multiply:
+        blendRow<BlendMultiply>(dst, src, count);
+        break;
+    case OverlayStack::Screen:
+        blendRow<BlendScreen>(dst, src, count);
+        break;
+    case OverlayStack::Add:
+        blendRow<BlendAdd>(dst, src, count);
+        break;
+    case OverlayStack::Over:
+    default:
+        blendRow<BlendOver>(dst, src, count);
+    }
+}
+
+static Gravity gravityFromString(const QString &name, Gravity fallback)
+{
+    for (int g = North; g <= Center; g++)
+        if (name == dialogdata::gravityStrings[g])
+            return Gravity(g);
+    return fallback;
+}
+
+//----------------------------------------------------------------------------
+
+OverlayStack::OverlayStack(const QStringList &spec)
+{
+    for (const QString &line : spec) {
+        Layer layer;
+        if (parse(line.trimmed(), layer))
+            layers.append(layer);
+    }
+}
+
+bool OverlayStack::isEmpty() const
+{
+    return layers.isEmpty();
+}
+
+bool OverlayStack::parse(const QString &line, Layer &layer)
+{
+    QStringList parts = line.split(';', skipEmptyParts);
+    if (parts.isEmpty() || line.startsWith('#'))
+        return false;
+    QString head = parts.takeFirst().trimmed();
+    QString type = head.section(':', 0, 0);
+    layer.argument = head.section(':', 1);
+    layer.blend = Over;
+    layer.gravity = Center;
+    layer.opacity = 1.0;
+    layer.margin = defaultMargin;
+    layer.color = Qt::white;
+    layer.size = defaultTextSize;
+    layer.strength = 0.5;
+    layer.stretch = false;
+
+    if (type == "image") {
+        layer.kind = ImageLayer;
+    } else if (type == "vignette") {
+        layer.kind = VignetteLayer;
+    } else if (type == "wash") {
+        layer.kind = WashLayer;
+        layer.color = QColor(layer.argument);
+    } else if (type == "clock") {
+        layer.kind = ClockLayer;
+        layer.gravity = NorthEast;
+        layer.format = "hh:mm";
+    } else if (type == "date") {
+        layer.kind = DateLayer;
+        layer.gravity = NorthEast;
+        layer.format = "dddd d MMMM";
+    } else {
+        return false;
+    }
+
+    for (const QString &part : parts) {
+        QString key = part.section('=', 0, 0).trimmed();
+        QString value = part.section('=', 1).trimmed();
+        if (key == "blend")
+            layer.blend = value == "multiply" ? Multiply :
+                          value == "screen" ? Screen :
+                          value == "add" ? Add : Over;
+        else if (key == "gravity")
+            layer.gravity = gravityFromString(value, layer.gravity);
+        else if (key == "opacity")
+            layer.opacity = qBound(0.0, value.toDouble(), 1.0);
+        else if (key == "margin")
+            layer.margin = value.toInt();
+        else if (key == "color")
+            layer.color = QColor(value);
+        else if (key == "size")
+            layer.size = std::max(1, value.toInt());
+        else if (key == "format")
+            layer.format = value;
+        else if (key == "strength")
+            layer.strength = qBound(0.0, value.toDouble(), 1.0);
+        else if (key == "stretch")
+            layer.stretch = true;
+    }
+    return true;
+}
+
+QString OverlayStack::layerText(const Layer &layer, const QDateTime &when)
+{
+    if (layer.kind == ClockLayer)
+        return when.time().toString(layer.format);
+    if (layer.kind == DateLayer)
+        return when.date().toString(layer.format);
+    return QString();
+}
+
+void OverlayStack::rasterize(Layer &layer, const QSize &target,
+                             const QString &text)
+{
+    QImage raster;
+    switch (layer.kind) {
+    case ImageLayer: {
+        QImage image(layer.argument);
+        if (image.isNull())
+            break;
+        if (layer.stretch)
+            image = image.scaled(target, Qt::IgnoreAspectRatio,
+                                 Qt::SmoothTransformation);
+        raster = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        break;
+    }
+    case VignetteLayer: {
+        raster = QImage(target, QImage::Format_ARGB32_Premultiplied);
+        raster.fill(Qt::transparent);
+        QPainter p(&raster);
+        QPointF centre(target.width() / 2.0, target.height() / 2.0);
+        qreal radius = std::hypot(centre.x(), centre.y());
+        QRadialGradient g(centre, radius);
+        g.setColorAt(0.5, QColor(0, 0, 0, 0));
+        g.setColorAt(1.0, QColor(0, 0, 0, int(255 * layer.strength)));
+        p.fillRect(raster.rect(), g);
+        break;
+    }
+    case WashLayer:
+        raster = QImage(target, QImage::Format_ARGB32_Premultiplied);
+        raster.fill(layer.color);
+        break;
+    case ClockLayer:
+    case DateLayer: {
+        QFont font;
+        font.setPixelSize(layer.size);
+        QFontMetrics metrics(font);
+        QRect bounds = metrics.boundingRect(text).adjusted(-4, -4, 4, 4);
+        raster = QImage(bounds.size(), QImage::Format_ARGB32_Premultiplied);
+        raster.fill(Qt::transparent);
+        QPainter p(&raster);
+        p.setRenderHint(QPainter::TextAntialiasing);
+        p.setFont(font);
+        p.translate(-bounds.topLeft());
+        // a soft shadow keeps the badge legible on any wallpaper
+        p.setPen(QColor(0, 0, 0, 160));
+        p.drawText(2, 2, text);
+        p.setPen(layer.color);
+        p.drawText(0, 0, text);
+        break;
+    }
+    }
+
+    if (!raster.isNull() && layer.opacity < 1.0) {
+        QImage faded(raster.size(), QImage::Format_ARGB32_Premultiplied);
+        faded.fill(Qt::transparent);
+        QPainter p(&faded);
+        p.setOpacity(layer.opacity);
+        p.drawImage(0, 0, raster);
+        p.end();
+        raster = faded;
+    }
+
+    layer.raster = raster;
+    layer.text = text;
+    QSize inner = target - QSize(2 * layer.margin, 2 * layer.margin);
+    if (raster.size() == target || inner.isEmpty())
+        layer.offset = Render::gravityOffset(raster.size(), target,
+                                             layer.gravity);
+    else
+        layer.offset = Render::gravityOffset(raster.size(), inner,
+                                             layer.gravity)
+                + QPoint(layer.margin, layer.margin);
+}
+
+void OverlayStack::apply(QImage &wall, const QDateTime &shownAt)
+{
+    if (layers.isEmpty() || wall.isNull())
+        return;
+    QDateTime when = shownAt.isValid() ? shownAt : QDateTime::currentDateTime();
+    QMutexLocker lock(&mutex);
+    if (wall.format() != QImage::Format_RGB32)
+        wall = wall.convertToFormat(QImage::Format_RGB32);
+
+    bool resized = wall.size() != target;
+    target = wall.size();
+    for (Layer &layer : layers) {
+        QString text = layerText(layer, when);
+        if (resized || layer.raster.isNull() || text != layer.text)
+            rasterize(layer, target, text);
+    }
+
+    // one pass down the wallpaper, every layer that covers a row is blended
+    // into it while the row is still in cache
+    QRect screen = wall.rect();
+    for (int y = 0; y < wall.height(); y++) {
+        quint32 *dst = reinterpret_cast<quint32*>(wall.scanLine(y));
+        for (const Layer &layer : layers) {
+            QRect r = QRect(layer.offset, layer.raster.size()) & screen;
+            if (y < r.top() || y > r.bottom())
+                continue;
+            const quint32 *src = reinterpret_cast<const quint32*>(
+                        layer.raster.constScanLine(y - layer.offset.y()));
+            blendRow(layer.blend, dst + r.left(),
+                     src + (r.left() - layer.offset.x()), r.width());
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <QColor>
+#include <QDateTime>
+#include <QImage>
+#include <QMutex>
+#include <QPoint>
+#include <QStringList>
+#include <QVector>
+#include "dialogdata.h"
+
+// A stack of overlay layers drawn over every wallpaper, in the spirit of
+// KDE3's wallpaper overlays.  Each line of the spec is one layer:
+//
+//   image:/path/frame.png;stretch;blend=multiply
+//   vignette;strength=0.6
+//   wash:#ff8000;blend=screen;opacity=0.2
+//   clock;format=hh:mm;gravity=northeast;size=64;color=#ffffff
+//   date;format=dddd d MMMM;gravity=southwest
+//
+// Common keys are blend (over, multiply, screen, add), gravity, opacity and
+// margin.  Layers are rasterized premultiplied once per target size (and
+// per text for clock and date badges) and kept; applying the stack is then
+// a single pass over the wallpaper's rows.
+class OverlayStack
+{
+public:
+    enum Blend { Over, Multiply, Screen, Add };
+
+    explicit OverlayStack(const QStringList &spec = QStringList());
+    bool isEmpty() const;
+    // Clock and date badges show shownAt, the time the wallpaper goes up;
+    // now if it is null.
+    void apply(QImage &wall, const QDateTime &shownAt = QDateTime());
+
+private:
+    enum Kind { ImageLayer, VignetteLayer, WashLayer, ClockLayer, DateLayer };
+    struct Layer {
+        Kind kind;
+        Blend blend;
+        Gravity gravity;
+        qreal opacity;
+        int margin;
+        QString argument;
+        QString format;
+        QColor color;
+        int size;
+        qreal strength;
+        bool stretch;
+        // cache
+        QString text;
+        QImage raster;
+        QPoint offset;
+    };
+
+    static bool parse(const QString &line, Layer &layer);
+    void rasterize(Layer &layer, const QSize &target, const QString &text);
+    QString layerText(const Layer &layer, const QDateTime &when);
+
+    QVector<Layer> layers;
+    QSize target;
+    QMutex mutex;
+};
+
+#endif // OVERLAY_H
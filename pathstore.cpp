@@ -0,0 +1,220 @@
+#include "pathstore.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QVector>
+#include <algorithm>
+
+static const quint32 storeMagic = 0x33313470;      // "p413"
+static const quint32 storeVersion = 1;
+static const int blockPaths = 16;
+
+struct Header {
+    quint32 magic;
+    quint32 version;
+    quint32 count;
+    quint32 blocks;
+    quint64 digest;
+};
+
+// Either the encoded bytes we built, or a mapped file holding them.
+struct PathStore::Data {
+    QByteArray owned;
+    QFile file;
+    const char *base;
+    qint64 size;
+
+    const Header &header() const
+    {
+        return *reinterpret_cast<const Header*>(base);
+    }
+    const quint32 *offsets() const
+    {
+        return reinterpret_cast<const quint32*>(base + sizeof(Header));
+    }
+    const char *blocks() const
+    {
+        return base + sizeof(Header) + header().blocks * sizeof(quint32);
+    }
+};
+
+static void putVarint(QByteArray &out, quint32 value)
+{
+    while (value >= 0x80) {
+        out.append(char(value | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+static quint32 getVarint(const char *&p)
+{
+    quint32 value = 0;
+    for (int shift = 0; ; shift += 7) {
+        uchar c = uchar(*p++);
+        value |= quint32(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return value;
+    }
+}
+
+// FNV-1a
+static quint64 digestOf(const char *data, qint64 size)
+{
+    quint64 h = 14695981039346656037ull;
+    for (qint64 i = 0; i < size; i++) {
+        h ^= uchar(data[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+PathStore::PathStore() : PathStore(QStringList())
+{
+
+}
+
+PathStore::PathStore(QStringList paths)
+{
+    // duplicates stay: a list naming a file twice picks it twice as often
+    paths.sort();
+    int blocks = (paths.count() + blockPaths - 1) / blockPaths;
+
+    QByteArray encoded;
+    QVector<quint32> offsets(blocks);
+    QByteArray previous;
+    for (int i = 0; i < paths.count(); i++) {
+        QByteArray path = paths[i].toUtf8();
+        if (i % blockPaths == 0) {
+            offsets[i / blockPaths] = quint32(encoded.size());
+            putVarint(encoded, quint32(path.size()));
+            encoded.append(path);
+        } else {
+            int shared = 0;
+            int most = std::min(path.size(), previous.size());
+            while (shared < most && path[shared] == previous[shared])
+                shared++;
+            putVarint(encoded, quint32(shared));
+            putVarint(encoded, quint32(path.size() - shared));
+            encoded.append(path.constData() + shared, path.size() - shared);
+        }
+        previous = path;
+    }
+
+    Header h = { storeMagic, storeVersion, quint32(paths.count()),
+                 quint32(blocks), digestOf(encoded.constData(), encoded.size()) };
+    Data *data = new Data;
+    data->owned.reserve(int(sizeof(h)) + blocks * int(sizeof(quint32))
+                        + encoded.size());
+    data->owned.append(reinterpret_cast<const char*>(&h), sizeof(h));
+    data->owned.append(reinterpret_cast<const char*>(offsets.constData()),
+                       blocks * int(sizeof(quint32)));
+    data->owned.append(encoded);
+    data->base = data->owned.constData();
+    data->size = data->owned.size();
+    d.reset(data);
+}
+
+PathStore::PathStore(const QSharedPointer<const Data> &d) : d(d)
+{
+
+}
+
+PathStore PathStore::load(const QString &fileName)
+{
+    QSharedPointer<Data> data(new Data);
+    data->file.setFileName(fileName);
+    if (!data->file.open(QIODevice::ReadOnly)
+            || data->file.size() < qint64(sizeof(Header)))
+        return PathStore();
+    data->size = data->file.size();
+    data->base = reinterpret_cast<const char*>(data->file.map(0, data->size));
+    if (!data->base)
+        return PathStore();
+    // the file is closed, the mapping stays until the store goes
+    data->file.close();
+    const Header &h = data->header();
+    qint64 headBytes = qint64(sizeof(Header)) + qint64(h.blocks) * sizeof(quint32);
+    if (h.magic != storeMagic || h.version != storeVersion
+            || headBytes > data->size
+            || h.blocks != (h.count + blockPaths - 1) / blockPaths
+            || h.digest != digestOf(data->blocks(), data->size - headBytes))
+        return PathStore();
+    return PathStore(data);
+}
+
+bool PathStore::save(const QString &fileName) const
+{
+    QSaveFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly))
+        return false;
+    f.write(d->base, d->size);
+    return f.commit();
+}
+
+int PathStore::count() const
+{
+    return int(d->header().count);
+}
+
+bool PathStore::isEmpty() const
+{
+    return count() == 0;
+}
+
+QString PathStore::at(int index) const
+{
+    if (index < 0 || index >= count())
+        return QString();
+    const char *p = d->blocks() + d->offsets()[index / blockPaths];
+    quint32 length = getVarint(p);
+    QByteArray path(p, int(length));
+    p += length;
+    for (int i = 0; i < index % blockPaths; i++) {
+        quint32 shared = getVarint(p);
+        quint32 tail = getVarint(p);
+        path.truncate(int(shared));
+        path.append(p, int(tail));
+        p += tail;
+    }
+    return QString::fromUtf8(path);
+}
+
+QStringList PathStore::toList() const
+{
+    QStringList paths;
+    paths.reserve(count());
+    for (int block = 0; block * blockPaths < count(); block++) {
+        const char *p = d->blocks() + d->offsets()[block];
+        quint32 length = getVarint(p);
+        QByteArray path(p, int(length));
+        p += length;
+        paths.append(QString::fromUtf8(path));
+        int last = std::min(count(), (block + 1) * blockPaths);
+        for (int i = block * blockPaths + 1; i < last; i++) {
+            quint32 shared = getVarint(p);
+            quint32 tail = getVarint(p);
+            path.truncate(int(shared));
+            path.append(p, int(tail));
+            p += tail;
+            paths.append(QString::fromUtf8(path));
+        }
+    }
+    return paths;
+}
+
+qint64 PathStore::bytes() const
+{
+    return d->size;
+}
+
+bool PathStore::operator==(const PathStore &other) const
+{
+    return d == other.d || (count() == other.count()
+                            && d->header().digest == other.d->header().digest);
+}
+
+bool PathStore::operator!=(const PathStore &other) const
+{
+    return !(*this == other);
+}
@@ -0,0 +1,39 @@
+#ifndef PATHSTORE_H
+#define PATHSTORE_H
+
+#include <QSharedPointer>
+#include <QStringList>
+
+// A read-only list of file paths, front-coded: the paths are sorted (a
+// path listed twice is kept twice, costing two bytes the second time) and
+// kept in blocks of 16, each holding its first path whole and the others
+// as the number of bytes shared with the path before plus the new tail.
+// Library paths share long prefixes, so this is a fraction of the size of
+// a QStringList.  The encoded form is also the file format, and a saved
+// store is mapped back in rather than parsed.  Copies share their data.
+class PathStore
+{
+public:
+    PathStore();
+    explicit PathStore(QStringList paths);
+    static PathStore load(const QString &fileName);
+    bool save(const QString &fileName) const;
+
+    int count() const;
+    bool isEmpty() const;
+    QString at(int index) const;
+    QStringList toList() const;
+    qint64 bytes() const;
+
+    // by content, through a digest of the encoded paths
+    bool operator==(const PathStore &other) const;
+    bool operator!=(const PathStore &other) const;
+
+private:
+    struct Data;
+    explicit PathStore(const QSharedPointer<const Data> &d);
+
+    QSharedPointer<const Data> d;
+};
+
+#endif // PATHSTORE_H
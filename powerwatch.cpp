@@ -0,0 +1,104 @@
+#include "powerwatch.h"
+
+#include <QDBusConnection>
+#include <QDBusInterface>
+#include <QDBusReply>
+#include <algorithm>
+#include <limits>
+
+static const char screenSaverService[] = "org.freedesktop.ScreenSaver";
+static const char screenSaverPath[] = "/org/freedesktop/ScreenSaver";
+static const char screenSaverInterface[] = "org.freedesktop.ScreenSaver";
+static const char upowerService[] = "org.freedesktop.UPower";
+static const char upowerPath[] = "/org/freedesktop/UPower";
+static const char upowerInterface[] = "org.freedesktop.UPower";
+static const char propertiesInterface[] = "org.freedesktop.DBus.Properties";
+static const int batteryStretch = 4;
+
+PowerWatch::PowerWatch(QObject *parent) : QObject(parent),
+    locked(false), battery(false)
+{
+    QDBusConnection::sessionBus().connect(screenSaverService, screenSaverPath,
+                                          screenSaverInterface, "ActiveChanged",
+                                          this, SLOT(screenSaver_activeChanged(bool)));
+    QDBusConnection::systemBus().connect(upowerService, upowerPath,
+                                         propertiesInterface, "PropertiesChanged",
+                                         this, SLOT(upower_propertiesChanged(QString,QVariantMap,QStringList)));
+    fetchScreenSaver();
+    fetchUPower();
+}
+
+bool PowerWatch::screenLocked()
+{
+    return locked;
+}
+
+bool PowerWatch::onBattery()
+{
+    return battery;
+}
+
+int PowerWatch::interval(qint64 base)
+{
+    if (battery)
+        base *= batteryStretch;
+    return int(std::min<qint64>(base, std::numeric_limits<int>::max()));
+}
+
+PowerWatch::UnlockStep PowerWatch::unlockStep(bool locked, bool frameReady)
+{
+    if (locked && !frameReady)
+        return PrepareFrame;
+    if (!locked && frameReady)
+        return ShowFrame;
+    return NothingToDo;
+}
+
+void PowerWatch::screenSaver_activeChanged(bool active)
+{
+    if (locked == active)
+        return;
+    locked = active;
+    emit changed();
+}
+
+void PowerWatch::upower_propertiesChanged(const QString &interface,
+                                          const QVariantMap &changed,
+                                          const QStringList &invalidated)
+{
+    if (interface != upowerInterface)
+        return;
+    if (changed.contains("OnBattery")) {
+        bool b = changed.value("OnBattery").toBool();
+        if (b != battery) {
+            battery = b;
+            emit this->changed();
+        }
+    } else if (invalidated.contains("OnBattery")) {
+        fetchUPower();
+    }
+}
+
+void PowerWatch::fetchScreenSaver()
+{
+    QDBusInterface saver(screenSaverService, screenSaverPath,
+                         screenSaverInterface, QDBusConnection::sessionBus());
+    if (!saver.isValid())
+        return;
+    QDBusReply<bool> reply = saver.call("GetActive");
+    if (reply.isValid())
+        screenSaver_activeChanged(reply.value());
+}
+
+void PowerWatch::fetchUPower()
+{
+    QDBusInterface upower(upowerService, upowerPath, upowerInterface,
+                          QDBusConnection::systemBus());
+    if (!upower.isValid())
+        return;
+    QVariant b = upower.property("OnBattery");
+    if (b.isValid() && b.toBool() != battery) {
+        battery = b.toBool();
+        emit changed();
+    }
+}
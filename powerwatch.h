@@ -0,0 +1,46 @@
+#ifndef POWERWATCH_H
+#define POWERWATCH_H
+
+#include <QObject>
+#include <QVariantMap>
+#include <QStringList>
+
+// Follows the screensaver (org.freedesktop.ScreenSaver on the session bus)
+// and the power supply (UPower on the system bus), so changes can stop
+// while nobody can see them and slow down on battery.  Both buses are
+// taken from the usual DBUS_*_BUS_ADDRESS variables, so stub services on
+// a private bus can stand in for the real ones (see tests/powerwatch).
+class PowerWatch : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PowerWatch(QObject *parent = nullptr);
+    bool screenLocked();
+    bool onBattery();
+    // Milliseconds between changes for a chosen interval of base: stretched
+    // on battery, and never past what a timer takes.
+    int interval(qint64 base);
+
+    // What a change of the screen's state calls for: a wallpaper rendered
+    // while it is locked, shown the moment it comes back.
+    enum UnlockStep { NothingToDo, PrepareFrame, ShowFrame };
+    static UnlockStep unlockStep(bool locked, bool frameReady);
+
+signals:
+    void changed();
+
+private slots:
+    void screenSaver_activeChanged(bool active);
+    void upower_propertiesChanged(const QString &interface,
+                                  const QVariantMap &changed,
+                                  const QStringList &invalidated);
+
+private:
+    void fetchScreenSaver();
+    void fetchUPower();
+
+    bool locked;
+    bool battery;
+};
+
+#endif // POWERWATCH_H
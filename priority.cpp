@@ -0,0 +1,96 @@
+#include "priority.h"
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// from linux/ioprio.h, which is not always installed
+static const int ioprioWhoProcess = 1;
+static const int ioprioClassIdle = 3;
+static const int ioprioClassShift = 13;
+
+IdleProcess::IdleProcess(QObject *parent) : QProcess(parent)
+{
+
+}
+
+void IdleProcess::setupChildProcess()
+{
+    Priority::makeIdle();
+}
+
+//----------------------------------------------------------------------------
+
+void Priority::makeIdle()
+{
+    // on linux both of these act on the calling thread only
+    pid_t tid = pid_t(syscall(SYS_gettid));
+    setpriority(PRIO_PROCESS, id_t(tid), 19);
+    syscall(SYS_ioprio_set, ioprioWhoProcess, tid,
+            ioprioClassIdle << ioprioClassShift);
+}
+
+// A helper of blockingMap, dropping its pool thread to idle first.
+class IdleHelper : public QRunnable
+{
+public:
+    explicit IdleHelper(const std::function<void()> &work) : work(work) { }
+    void run() override
+    {
+        Priority::makeIdle();
+        work();
+    }
+
+private:
+    std::function<void()> work;
+};
+
+static QThreadPool *idlePool()
+{
+    static QThreadPool pool;
+    return &pool;
+}
+
+void Priority::blockingMap(int count, const std::function<void(int)> &job)
+{
+    QAtomicInt next(0);
+    QSemaphore done;
+    auto work = [&]() {
+        for (int i; (i = next.fetchAndAddRelaxed(1)) < count; )
+            job(i);
+    };
+    // helpers that cannot start at once are not waited for: the calling
+    // thread does their share
+    int helpers = 0;
+    for (; helpers < count - 1; helpers++) {
+        IdleHelper *helper = new IdleHelper([&]() {
+            work();
+            done.release();
+        });
+        if (!idlePool()->tryStart(helper)) {
+            delete helper;
+            break;
+        }
+    }
+    work();
+    done.acquire(helpers);
+}
+
+void Priority::start(const std::function<void()> &job)
+{
+    idlePool()->start(new IdleHelper(job));
+}
+
+void Priority::waitForDone()
+{
+    idlePool()->waitForDone();
+}
+
+int Priority::threadCount()
+{
+    return idlePool()->maxThreadCount() + 1;
+}
@@ -0,0 +1,34 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include <QProcess>
+#include <functional>
+
+// A QProcess whose child runs at idle cpu and io priority.
+class IdleProcess : public QProcess
+{
+    Q_OBJECT
+public:
+    explicit IdleProcess(QObject *parent = nullptr);
+
+protected:
+    void setupChildProcess() override;
+};
+
+namespace Priority {
+// Drop the calling thread to idle cpu and io priority.  There is no way
+// back up without privileges, so only for threads of our own.
+void makeIdle();
+// Run job(0) to job(count - 1) and wait for them: on the calling thread,
+// and on those of a pool kept at idle priority that are free right away,
+// so it can be nested.  The global pool is left alone.
+void blockingMap(int count, const std::function<void(int)> &job);
+// Run job on that same pool when a thread is free, without waiting for it.
+void start(const std::function<void()> &job);
+// Wait for everything start() was given to be done.
+void waitForDone();
+// How many threads blockingMap can spread over: the pool's and the caller.
+int threadCount();
+}
+
+#endif // PRIORITY_H
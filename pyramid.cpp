@@ -0,0 +1,249 @@
+#include "pyramid.h"
+#include "framepool.h"
+#include "metrics.h"
+#include "render.h"
+#include "priority.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QSaveFile>
+#include <algorithm>
+#include <sys/stat.h>
+
+static const quint32 levelMagic = 0x3331346c;      // "l413"
+// levels smaller than this on either side are not worth a file
+static const int minLevelSide = 256;
+// the levels of about sixteen 24 megapixel photos (32 MB each), or of
+// four 96 megapixel scans (128 MB each)
+static const qint64 pyramidBudget = qint64(512) << 20;
+
+struct LevelHeader {
+    quint32 magic;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    qint32 format;
+};
+
+static QMutex folderMutex;
+static QString folder;
+
+void Pyramid::setFolder(const QString &folder)
+{
+    QMutexLocker lock(&folderMutex);
+    ::folder = folder;
+}
+
+static QString currentFolder()
+{
+    QMutexLocker lock(&folderMutex);
+    return folder;
+}
+
+static QString sourceKey(const QString &srcfname)
+{
+    QFileInfo info(srcfname);
+    QString id = QString("%1|%2|%3").arg(info.canonicalFilePath())
+            .arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch());
+    return QCryptographicHash::hash(id.toUtf8(),
+                                    QCryptographicHash::Sha1).toHex();
+}
+
+static QString levelPath(const QString &folder, const QString &key, int level)
+{
+    return QString("%1/%2-%3.level").arg(folder, key).arg(level);
+}
+
+// level sizes round down, as the halving drops odd rows and columns
+static QSize levelSize(const QSize &full, int level)
+{
+    return QSize(full.width() >> level, full.height() >> level);
+}
+
+static bool covers(const QSize &size, const QSize &cover)
+{
+    return size.width() >= cover.width() && size.height() >= cover.height();
+}
+
+static QImage readLevel(const QString &fname)
+{
+    QFile f(fname);
+    if (!f.open(QIODevice::ReadOnly))
+        return QImage();
+    LevelHeader h;
+    if (f.read(reinterpret_cast<char*>(&h), sizeof(h)) != sizeof(h)
+            || h.magic != levelMagic || h.width <= 0 || h.height <= 0
+            || (h.format != QImage::Format_RGB32
+                && h.format != QImage::Format_ARGB32))
+        return QImage();
+    QImage level = FramePool::instance()->acquire(QSize(h.width, h.height),
+                                                  QImage::Format(h.format));
+    int lineBytes = std::min(h.bytesPerLine, level.bytesPerLine());
+    for (int y = 0; y < h.height; y++) {
+        if (f.read(reinterpret_cast<char*>(level.scanLine(y)), lineBytes) != lineBytes
+                || !f.seek(f.pos() + h.bytesPerLine - lineBytes))
+            return QImage();
+    }
+    // the modification time doubles as the last use, for eviction
+    futimens(f.handle(), nullptr);
+    return level;
+}
+
+static bool writeLevel(const QString &fname, const QImage &level)
+{
+    QSaveFile f(fname);
+    if (!f.open(QIODevice::WriteOnly))
+        return false;
+    LevelHeader h = { levelMagic, level.width(), level.height(),
+                      level.bytesPerLine(), level.format() };
+    bool ok = f.write(reinterpret_cast<const char*>(&h), sizeof(h)) == sizeof(h);
+    for (int y = 0; ok && y < level.height(); y++)
+        ok = f.write(reinterpret_cast<const char*>(level.constScanLine(y)),
+                     level.bytesPerLine()) == level.bytesPerLine();
+    return ok && f.commit();
+}
+
+// Drop the levels used longest ago until the folder fits its budget.
+static void evict(const QString &folder)
+{
+    QFileInfoList levels = QDir(folder).entryInfoList({ "*.level" }, QDir::Files,
+                                                      QDir::Time);
+    qint64 total = 0;
+    for (const QFileInfo &info : levels)
+        total += info.size();
+    for (int i = levels.count() - 1; i >= 0 && total > pyramidBudget; i--) {
+        if (QFile::remove(levels[i].filePath())) {
+            total -= levels[i].size();
+            Metrics::add("pyramid/evictions");
+        }
+    }
+    Metrics::set("pyramid/bytes", total);
+}
+
+// 2x2 box straight from RGB32/ARGB32, to premultiplied linear RGBA64.
+static QImage halveSrgb(const QImage &source)
+{
+    QImage half = FramePool::instance()->acquire(levelSize(source.size(), 1),
+                                                 QImage::Format_RGBA64_Premultiplied);
+    for (int y = 0; y < half.height(); y++) {
+        const QRgb *rows[2] = {
+            reinterpret_cast<const QRgb*>(source.constScanLine(2 * y)),
+            reinterpret_cast<const QRgb*>(source.constScanLine(2 * y + 1))
+        };
+        QRgba64 *out = reinterpret_cast<QRgba64*>(half.scanLine(y));
+        for (int x = 0; x < half.width(); x++) {
+            quint32 r = 0, g = 0, b = 0, a = 0;
+            for (const QRgb *row : rows) {
+                for (int i = 2 * x; i < 2 * x + 2; i++) {
+                    QRgb px = row[i];
+                    quint32 pa = qAlpha(px);
+                    r += Render::srgbToLinear(qRed(px)) * pa / 255;
+                    g += Render::srgbToLinear(qGreen(px)) * pa / 255;
+                    b += Render::srgbToLinear(qBlue(px)) * pa / 255;
+                    a += pa * 257;
+                }
+            }
+            out[x] = QRgba64::fromRgba64(quint16((r + 2) / 4), quint16((g + 2) / 4),
+                                         quint16((b + 2) / 4), quint16((a + 2) / 4));
+        }
+    }
+    return half;
+}
+
+// 2x2 box on premultiplied linear RGBA64.
+static QImage halveLinear(const QImage &linear)
+{
+    QImage half = FramePool::instance()->acquire(levelSize(linear.size(), 1),
+                                                 QImage::Format_RGBA64_Premultiplied);
+    for (int y = 0; y < half.height(); y++) {
+        const QRgba64 *rows[2] = {
+            reinterpret_cast<const QRgba64*>(linear.constScanLine(2 * y)),
+            reinterpret_cast<const QRgba64*>(linear.constScanLine(2 * y + 1))
+        };
+        QRgba64 *out = reinterpret_cast<QRgba64*>(half.scanLine(y));
+        for (int x = 0; x < half.width(); x++) {
+            quint32 r = 0, g = 0, b = 0, a = 0;
+            for (const QRgba64 *row : rows) {
+                for (int i = 2 * x; i < 2 * x + 2; i++) {
+                    r += row[i].red();
+                    g += row[i].green();
+                    b += row[i].blue();
+                    a += row[i].alpha();
+                }
+            }
+            out[x] = QRgba64::fromRgba64(quint16((r + 2) / 4), quint16((g + 2) / 4),
+                                         quint16((b + 2) / 4), quint16((a + 2) / 4));
+        }
+    }
+    return half;
+}
+
+QImage Pyramid::lookup(const QString &srcfname, const QSize &full,
+                       const QSize &cover)
+{
+    QString folder = currentFolder();
+    if (folder.isEmpty() || !full.isValid() || cover.isEmpty())
+        return QImage();
+    // the deepest level that still covers, then shallower ones if missing
+    auto usable = [&](int level) {
+        QSize size = levelSize(full, level);
+        return covers(size, cover)
+                && std::min(size.width(), size.height()) >= minLevelSide;
+    };
+    int level = 0;
+    while (usable(level + 1))
+        level++;
+    QString key = sourceKey(srcfname);
+    for (; level > 0; level--) {
+        QImage image = readLevel(levelPath(folder, key, level));
+        if (!image.isNull()) {
+            Metrics::add("pyramid/hits");
+            return image;
+        }
+    }
+    Metrics::add("pyramid/misses");
+    return QImage();
+}
+
+QImage Pyramid::build(const QString &srcfname, const QImage &source,
+                      const QSize &cover)
+{
+    QString folder = currentFolder();
+    if (folder.isEmpty() || source.isNull()
+            || std::min(source.width(), source.height()) / 2 < minLevelSide
+            || !QDir().mkpath(folder))
+        return source;
+    QString key = sourceKey(srcfname);
+    QImage::Format format = source.hasAlphaChannel() ? QImage::Format_ARGB32
+                                                     : QImage::Format_RGB32;
+    QImage best = source;
+    QImage linear = halveSrgb(source);
+    int level = 1;
+    // the levels down to the one this render starts from are made now
+    for (; std::min(linear.width(), linear.height()) >= minLevelSide
+         && covers(linear.size(), cover); level++) {
+        best = Render::fromLinear(linear, format);
+        if (!writeLevel(levelPath(folder, key, level), best))
+            return best;
+        Metrics::add("pyramid/stores");
+        linear = halveLinear(linear);
+    }
+    // smaller ones only help smaller targets later, so they are left to an
+    // idle thread rather than holding up this change
+    Priority::start([folder, key, format, linear, level]() mutable {
+        for (; std::min(linear.width(), linear.height()) >= minLevelSide;
+             level++) {
+            if (!writeLevel(levelPath(folder, key, level),
+                            Render::fromLinear(linear, format)))
+                break;
+            Metrics::add("pyramid/stores");
+            linear = halveLinear(linear);
+        }
+        evict(folder);
+    });
+    return best;
+}
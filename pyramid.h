@@ -0,0 +1,31 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+// Pre-shrunk renditions of library images (1/2, 1/4, 1/8 ... of the
+// original), so a render for a new target size starts from the smallest
+// level that still covers it instead of decoding the original again.
+// Levels are halved with a box filter in linear light and stored raw, one
+// file each, in a folder of their own under the user's cache folder.
+// The folder is held to a budget, dropping the least recently used levels
+// first.  Safe to use from render threads.
+namespace Pyramid {
+
+// Where levels live; empty turns the pyramid off.
+void setFolder(const QString &folder);
+
+// The smallest stored level of srcfname (full being its size) that is at
+// least cover in both directions; null if there is none.
+QImage lookup(const QString &srcfname, const QSize &full, const QSize &cover);
+
+// Makes and stores the levels of source, the decoded srcfname, down to
+// the smallest that covers cover and returns it, or source itself.  The
+// levels below it are made afterwards on an idle thread.
+QImage build(const QString &srcfname, const QImage &source, const QSize &cover);
+
+}
+
+#endif // PYRAMID_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui dbus network
+QT       += core gui dbus network concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -12,15 +12,82 @@ TARGET = qt314wall
 TEMPLATE = app
 CONFIG += c++14
 
+# zip and cbz sources inflate entries themselves
+LIBS += -lz
+
 SOURCES += main.cpp\
         mainwindow.cpp \
-    source.cpp
+    source.cpp \
+    dialogdata.cpp \
+    render.cpp \
+    metrics.cpp \
+    scheduler.cpp \
+    framepool.cpp \
+    powerwatch.cpp \
+    priority.cpp \
+    overlay.cpp \
+    resample.cpp \
+    x11publisher.cpp \
+    mosaic.cpp \
+    catalog.cpp \
+    rendercache.cpp \
+    pathstore.cpp \
+    pyramid.cpp \
+    filecheck.cpp \
+    mirror.cpp \
+    thumbnailer.cpp \
+    librarymodel.cpp \
+    librarybrowser.cpp
 
 HEADERS  += mainwindow.h \
     main.h \
-    source.h
+    source.h \
+    dialogdata.h \
+    render.h \
+    metrics.h \
+    scheduler.h \
+    framepool.h \
+    powerwatch.h \
+    priority.h \
+    overlay.h \
+    resample.h \
+    x11publisher.h \
+    mosaic.h \
+    catalog.h \
+    rendercache.h \
+    pathstore.h \
+    pyramid.h \
+    filecheck.h \
+    mirror.h \
+    thumbnailer.h \
+    librarymodel.h \
+    librarybrowser.h \
+    qtcompat.h
 
 FORMS    += mainwindow.ui
 
 RESOURCES += \
     resource.qrc
+
+# Publish to the X11 root window ourselves instead of running xsetbg
+packagesExist(xcb xcb-shm) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += xcb xcb-shm
+    DEFINES += HAVE_XCB
+}
+
+# `make bench` builds bench/qt314wall-bench next to the app
+bench.target = bench
+bench.CONFIG = phony
+bench.commands = $(MKDIR) $$OUT_PWD/bench && cd $$OUT_PWD/bench && \
+    $(QMAKE) $$PWD/bench/bench.pro && $(MAKE)
+QMAKE_EXTRA_TARGETS += bench
+
+# `make check` builds the tests in tests/ and runs them against private
+# D-Bus and X servers
+check.target = check
+check.CONFIG = phony
+check.commands = $(MKDIR) $$OUT_PWD/tests && cd $$OUT_PWD/tests && \
+    $(QMAKE) $$PWD/tests/tests.pro && $(MAKE) && \
+    $$PWD/tests/run-tests.sh $$OUT_PWD/tests
+QMAKE_EXTRA_TARGETS += check
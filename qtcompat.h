@@ -0,0 +1,15 @@
+#ifndef QTCOMPAT_H
+#define QTCOMPAT_H
+
+#include <QString>
+
+// Spellings that moved between the Qt 5 releases we build against.
+
+// QString::SplitBehavior is deprecated from 5.14 in favour of Qt's own
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+static const auto skipEmptyParts = Qt::SkipEmptyParts;
+#else
+static const auto skipEmptyParts = QString::SkipEmptyParts;
+#endif
+
+#endif // QTCOMPAT_H
@@ -0,0 +1,820 @@
+#include "render.h"
+#include "framepool.h"
+#include "resample.h"
+#include "metrics.h"
+#include "catalog.h"
+#include "pyramid.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QHash>
+#include <QImageReader>
+#include <QPainter>
+#include <QProcess>
+#include <QSharedPointer>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace Render;
+
+//----------------------------------------------------------------------------
+
+// previews are decoded at this fraction of their size on the target
+static const int previewReduction = 2;
+// sources of more than this many target frames are only decoded in part
+static const int hugeSourceFrames = 16;
+// layer pixels decoded around a crop, for the scaling filter's reach
+static const int regionMargin = 4;
+
+// convert's o8x8 threshold map, thresholds are in 1..64
+static const int ditherMap[8][8] = {
+    {  1, 49, 13, 61,  4, 52, 16, 64 },
+    { 33, 17, 45, 29, 36, 20, 48, 32 },
+    {  9, 57,  5, 53, 12, 60,  8, 56 },
+    { 41, 25, 37, 21, 44, 28, 40, 24 },
+    {  3, 51, 15, 63,  2, 50, 14, 62 },
+    { 35, 19, 47, 31, 34, 18, 46, 30 },
+    { 11, 59,  7, 55, 10, 58,  6, 54 },
+    { 43, 27, 39, 23, 42, 26, 38, 22 }
+};
+
+static inline int ditherChannel(int v, int steps, int threshold)
+{
+    int t = v * (steps * 64 + 1) / 255;
+    int level = t / 64;
+    int remainder = t - level * 64;
+    return std::min(255, (level + (remainder >= threshold)) * 255 / steps);
+}
+
+static int ditherLevels(const QColor &bgcolor)
+{
+    return std::max(std::max(bgcolor.red(), bgcolor.blue()), bgcolor.green());
+}
+
+// sRGB transfer curves, for filling the tables
+static double srgbCurveToLinear(double c)
+{
+    return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+}
+
+static double linearCurveToSrgb(double l)
+{
+    return l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1 / 2.4) - 0.055;
+}
+
+// 8-bit sRGB to 16-bit linear, and every 16-bit linear value back to sRGB.
+// The second table is 64k, which still sits in L2 while a frame converts.
+struct ColorLut {
+    quint16 toLinear[256];
+    quint8 toSrgb[65536];
+
+    ColorLut() {
+        for (int i = 0; i < 256; i++)
+            toLinear[i] = quint16(std::lround(srgbCurveToLinear(i / 255.0) * 65535));
+        for (int i = 0; i < 65536; i++)
+            toSrgb[i] = quint8(std::lround(linearCurveToSrgb(i / 65535.0) * 255));
+    }
+};
+
+static const ColorLut &colorLut()
+{
+    static const ColorLut lut;
+    return lut;
+}
+
+// The renderer works on 32-bit pixels with straight alpha, as convert does.
+static bool isWorkingFormat(QImage::Format format)
+{
+    return format == QImage::Format_RGB32 || format == QImage::Format_ARGB32;
+}
+
+static QImage toWorkingFormat(const QImage &image)
+{
+    if (isWorkingFormat(image.format()))
+        return image;
+    return image.convertToFormat(image.hasAlphaChannel()
+                                 ? QImage::Format_ARGB32
+                                 : QImage::Format_RGB32);
+}
+
+// QImage::copy, but into a pooled buffer
+static QImage copyRect(const QImage &source, const QRect &rect)
+{
+    QRect r = rect & source.rect();
+    QImage copy = FramePool::instance()->acquire(r.size(), source.format());
+    int pixelBytes = source.depth() / 8;
+    int lineBytes = r.width() * pixelBytes;
+    for (int y = 0; y < r.height(); y++)
+        memcpy(copy.scanLine(y),
+               source.constScanLine(r.y() + y) + r.x() * pixelBytes,
+               size_t(lineBytes));
+    return copy;
+}
+
+//----------------------------------------------------------------------------
+
+QString Params::targetString() const
+{
+    return QString("%1x%2").arg(target.width()).arg(target.height());
+}
+
+bool Params::sameGeometry(const Params &other) const
+{
+    return target == other.target && scale == other.scale
+            && weight == other.weight && filter == other.filter
+            && tiles == other.tiles && focus == other.focus;
+}
+
+bool Params::operator==(const Params &other) const
+{
+    return sameGeometry(other) && bgcolor == other.bgcolor
+            && multiply == other.multiply;
+}
+
+//----------------------------------------------------------------------------
+
+// convert has no automatic gravity; it is Center outside of crops
+static QString convertGravity(Gravity g)
+{
+    return dialogdata::gravityStrings[g == Automatic ? Center : g];
+}
+
+// p with the source's subject filled in, where the crop follows it.  The
+// catalog usually knows it from indexing; if not, a small decode is
+// analysed, unless only what is known will do.
+static Params focused(const QString &srcfname, const Params &p,
+                      bool knownOnly = false)
+{
+    Params q = p;
+    if (p.scale != ScaledCropped || p.weight != Automatic)
+        return q;
+    if (!knownOnly)
+        q.focus = Catalog::instance()->cropFocus(srcfname);
+    else if (!Catalog::instance()->knownFocus(srcfname, &q.focus))
+        q.focus = QPointF(0.5, 0.5);
+    return q;
+}
+
+QStringList Render::convertArguments(const QString &srcfname,
+                                     const QString &destfname,
+                                     const Params &params)
+{
+    // called on the GUI thread: whoever calls it finds the focus first
+    Params p = focused(srcfname, params, true);
+    QString targetString(p.targetString());
+    QString rs(targetString);
+    rs.append("^");
+    QString rs2(targetString);
+    rs2.append("+0+0");
+    // convert to linear space
+    QStringList args;
+    args << srcfname << "-colorspace" << "RGB";
+    switch (p.scale) {
+    case ScaledProportions:
+        // scale to fit
+        args << "-resize" << targetString
+             << "-size" << targetString
+             << "-gravity" << convertGravity(p.weight);
+        break;
+    case ScaledCropped:
+        // scale to cover
+        args << "-resize" << rs;
+        if (p.weight == Automatic) {
+            // cut where the native renderer does, to the pixel
+            QSize size = fitSize(Catalog::instance()->imageSize(srcfname),
+                                 p.target, true);
+            QPoint crop = cropOrigin(size, p);
+            args << "-gravity" << "northwest"
+                 << "-crop" << QString("%1+%2+%3").arg(targetString)
+                                .arg(crop.x()).arg(crop.y())
+                 << "+repage";
+        } else {
+            args << "-gravity" << "center"
+                 << "-crop" << rs2;
+        }
+        args << "-write" << "mpr:src" << "+delete"
+             << "-background" << "rgba(255,255,255)"
+             << "-size" << targetString
+             << "mpr:src";
+        break;
+    case TiledNotScaled:
+        // tile oversize for screen, then crop  (fairly expensive tbh)
+        args << "-write" << "mpr:src" << "+delete"
+             << "-background" << "rgba(0,0,0,0)"
+             << "-size" << calcTileSize(srcfname, p)
+             << "tile:mpr:src"
+             << "-gravity" << convertGravity(p.weight)
+             << "-size" << targetString;
+        break;
+    case NotScaled:
+    case Mosaic:        // only rendered in-process, see mosaic.h
+    default:
+        // place at corner
+        args << "-size" << targetString
+             << "-gravity" << convertGravity(p.weight);
+    }
+    // convert to monitor space
+    args << "-colorspace" << "sRGB";
+    if (p.multiply)      // dither before multiply to reduce banding
+        args << "-ordered-dither" << QString("8x8,%1,%1,%1").arg(
+                    ditherLevels(p.bgcolor));
+    // create background
+    args << QString("xc:%1").arg(p.bgcolor.name()) << "+swap";
+    if (p.multiply)      // apply screen
+        args << "-compose" << "multiply";
+    // make wall
+    args << "-composite" << destfname;
+    return args;
+}
+
+QString Render::calcTileSize(const QString &srcfname, const Params &p)
+{
+    QProcess proc;
+    proc.start("identify", QStringList() << "-format" << "%w\t%h" << srcfname);
+    proc.waitForFinished();
+    QStringList qsl = QString::fromUtf8(proc.readLine()).trimmed().split("\t");
+    if (qsl.count() < 2) {
+        return p.targetString();
+    }
+    int w = qsl.at(0).toInt();
+    int h = qsl.at(1).toInt();
+
+    int tx = ((p.target.width() / w) + 1) | 1;
+    int ty = ((p.target.height() / h) + 1) | 1;
+
+    int ox = w*tx;
+    int oy = h*ty;
+
+    return QString("%1x%2").arg(ox).arg(oy);
+}
+
+//----------------------------------------------------------------------------
+
+QPoint Render::gravityOffset(const QSize &layer, const QSize &target,
+                             Gravity g)
+{
+    int left = 0, middle = target.width()/2 - layer.width()/2,
+            right = target.width() - layer.width();
+    int top = 0, centre = target.height()/2 - layer.height()/2,
+            bottom = target.height() - layer.height();
+    switch (g) {
+    case North:     return QPoint(middle, top);
+    case NorthEast: return QPoint(right, top);
+    case East:      return QPoint(right, centre);
+    case SouthEast: return QPoint(right, bottom);
+    case South:     return QPoint(middle, bottom);
+    case SouthWest: return QPoint(left, bottom);
+    case West:      return QPoint(left, centre);
+    case NorthWest: return QPoint(left, top);
+    case Center:
+    default:        return QPoint(middle, centre);
+    }
+}
+
+QPoint Render::cropOrigin(const QSize &size, const Params &p)
+{
+    if (p.weight != Automatic)
+        return gravityOffset(p.target, size, Center);
+    // the subject as near the middle as the source allows
+    int x = int(std::lround(p.focus.x() * size.width() - p.target.width() / 2.0));
+    int y = int(std::lround(p.focus.y() * size.height() - p.target.height() / 2.0));
+    return QPoint(qBound(0, x, qMax(0, size.width() - p.target.width())),
+                  qBound(0, y, qMax(0, size.height() - p.target.height())));
+}
+
+QSize Render::fitSize(const QSize &source, const QSize &target, bool cover)
+{
+    if (source.isEmpty())
+        return source;
+    double sx = double(target.width()) / source.width();
+    double sy = double(target.height()) / source.height();
+    double scale = cover ? std::max(sx, sy) : std::min(sx, sy);
+    return QSize(std::max(1, int(scale * source.width() + 0.5)),
+                 std::max(1, int(scale * source.height() + 0.5)));
+}
+
+QImage Render::loadImage(const QString &fname)
+{
+    QImageReader reader(fname);
+    QImage image;
+    // decoders reuse the image they are given when it matches
+    if (isWorkingFormat(reader.imageFormat()) && reader.size().isValid())
+        image = FramePool::instance()->acquire(reader.size(),
+                                               reader.imageFormat());
+    if (!reader.read(&image))
+        return QImage();
+    return toWorkingFormat(image);
+}
+
+QImage Render::loadRegion(const QString &fname, const QRect &rect,
+                          const QSize &size)
+{
+    // jpeg reads just the rows it needs and can shrink while decoding;
+    // other formats are cut from a full decode by QImageReader
+    QImageReader reader(fname);
+    reader.setClipRect(rect);
+    if (size != rect.size())
+        reader.setScaledSize(size);
+    QImage image;
+    if (!reader.read(&image))
+        return QImage();
+    return toWorkingFormat(image);
+}
+
+quint16 Render::srgbToLinear(quint8 value)
+{
+    return colorLut().toLinear[value];
+}
+
+quint8 Render::linearToSrgb(quint16 value)
+{
+    return colorLut().toSrgb[value];
+}
+
+QImage Render::toLinear(const QImage &image)
+{
+    const ColorLut &lut = colorLut();
+    QImage source = toWorkingFormat(image);
+    QImage linear = FramePool::instance()->acquire(source.size(),
+                                                   QImage::Format_RGBA64_Premultiplied);
+    for (int y = 0; y < source.height(); y++) {
+        const QRgb *in = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+        QRgba64 *out = reinterpret_cast<QRgba64*>(linear.scanLine(y));
+        for (int x = 0; x < source.width(); x++) {
+            QRgb px = in[x];
+            quint32 a = qAlpha(px);
+            quint32 r = lut.toLinear[qRed(px)];
+            quint32 g = lut.toLinear[qGreen(px)];
+            quint32 b = lut.toLinear[qBlue(px)];
+            if (a != 255) {
+                r = r * a / 255;
+                g = g * a / 255;
+                b = b * a / 255;
+            }
+            out[x] = QRgba64::fromRgba64(quint16(r), quint16(g), quint16(b),
+                                         quint16(a * 257));
+        }
+    }
+    return linear;
+}
+
+QImage Render::fromLinear(const QImage &linear, QImage::Format format)
+{
+    const ColorLut &lut = colorLut();
+    QImage image = FramePool::instance()->acquire(linear.size(), format);
+    bool opaque = format == QImage::Format_RGB32;
+    for (int y = 0; y < linear.height(); y++) {
+        const QRgba64 *in = reinterpret_cast<const QRgba64*>(linear.constScanLine(y));
+        QRgb *out = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < linear.width(); x++) {
+            QRgba64 px = in[x];
+            quint32 a = opaque ? 65535 : px.alpha();
+            quint32 r = px.red(), g = px.green(), b = px.blue();
+            if (a == 0) {
+                out[x] = 0;
+                continue;
+            }
+            if (a != 65535) {
+                r = std::min<quint32>(65535, r * 65535 / a);
+                g = std::min<quint32>(65535, g * 65535 / a);
+                b = std::min<quint32>(65535, b * 65535 / a);
+            }
+            out[x] = qRgba(lut.toSrgb[r], lut.toSrgb[g], lut.toSrgb[b],
+                           (a + 128) / 257);
+        }
+    }
+    return image;
+}
+
+QImage Render::scaleLinear(const QImage &image, const QSize &size,
+                           Filter filter)
+{
+    bool alpha = image.hasAlphaChannel();
+    if (filter == AutomaticFilter)
+        filter = automaticFilter(image.size(), size, alpha);
+    return fromLinear(resample(toLinear(image), size, filter),
+                      alpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+}
+
+Layer Render::placeLayer(const QImage &source, const Params &p)
+{
+    Layer layer;
+    QRect screen(QPoint(0,0), p.target);
+    switch (p.scale) {
+    case ScaledProportions: {
+        QSize size = fitSize(source.size(), p.target, false);
+        layer.image = scaleLinear(source, size, p.filter);
+        layer.offset = gravityOffset(size, p.target, p.weight);
+        break;
+    }
+    case ScaledCropped: {
+        QSize size = fitSize(source.size(), p.target, true);
+        QImage scaled = scaleLinear(source, size, p.filter);
+        QPoint crop = cropOrigin(size, p);
+        layer.image = copyRect(scaled, QRect(crop, p.target));
+        break;
+    }
+    case TiledNotScaled: {
+        int w = source.width(), h = source.height();
+        QSize tiles(((p.target.width() / w) + 1) | 1,
+                    ((p.target.height() / h) + 1) | 1);
+        QSize size(w * tiles.width(), h * tiles.height());
+        QPoint origin = gravityOffset(size, p.target, p.weight);
+        QRect visible = QRect(origin, size) & screen;
+        layer.image = FramePool::instance()->acquire(visible.size(),
+                                                     source.format());
+        layer.offset = visible.topLeft();
+        layer.phase = visible.topLeft() - origin;
+        QPainter painter(&layer.image);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        for (int y = -(layer.phase.y() % h); y < visible.height(); y += h)
+            for (int x = -(layer.phase.x() % w); x < visible.width(); x += w)
+                painter.drawImage(x, y, source);
+        break;
+    }
+    case NotScaled:
+    default: {
+        QPoint origin = gravityOffset(source.size(), p.target, p.weight);
+        QRect visible = QRect(origin, source.size()) & screen;
+        layer.image = copyRect(source, visible.translated(-origin));
+        layer.offset = visible.topLeft();
+        layer.phase = visible.topLeft() - origin;
+    }
+    }
+    return layer;
+}
+
+bool Render::isHugeSource(const QSize &full, const Params &p)
+{
+    return (p.scale == NotScaled || p.scale == ScaledCropped)
+            && qint64(full.width()) * full.height()
+               > qint64(hugeSourceFrames) * p.target.width() * p.target.height();
+}
+
+QRect Render::visibleSourceRect(const QSize &full, const Params &p)
+{
+    QRect whole(QPoint(0,0), full);
+    switch (p.scale) {
+    case NotScaled: {
+        QPoint origin = gravityOffset(full, p.target, p.weight);
+        return (QRect(origin, full) & QRect(QPoint(0,0), p.target))
+                .translated(-origin);
+    }
+    case ScaledCropped: {
+        QSize size = fitSize(full, p.target, true);
+        QPoint crop = cropOrigin(size, p);
+        double fx = double(full.width()) / size.width();
+        double fy = double(full.height()) / size.height();
+        int left = int(std::floor((crop.x() - regionMargin) * fx));
+        int top = int(std::floor((crop.y() - regionMargin) * fy));
+        int right = int(std::ceil((crop.x() + p.target.width() + regionMargin) * fx));
+        int bottom = int(std::ceil((crop.y() + p.target.height() + regionMargin) * fy));
+        return QRect(left, top, right - left, bottom - top) & whole;
+    }
+    default:
+        return whole;
+    }
+}
+
+Layer Render::placeRegion(const QImage &region, const QRect &rect,
+                          const QSize &full, const Params &p)
+{
+    Layer layer;
+    if (p.scale == ScaledCropped) {
+        // where the region lands on the whole scaled layer, to the pixel
+        QSize size = fitSize(full, p.target, true);
+        double sx = double(size.width()) / full.width();
+        double sy = double(size.height()) / full.height();
+        QPoint topLeft(int(std::lround(rect.x() * sx)), int(std::lround(rect.y() * sy)));
+        QPoint bottomRight(int(std::lround((rect.right() + 1) * sx)),
+                           int(std::lround((rect.bottom() + 1) * sy)));
+        QImage scaled = scaleLinear(region, QSize(bottomRight.x() - topLeft.x(),
+                                                  bottomRight.y() - topLeft.y()),
+                                    p.filter);
+        QPoint crop = cropOrigin(size, p);
+        layer.image = copyRect(scaled, QRect(crop - topLeft, p.target));
+    } else {
+        QPoint origin = gravityOffset(full, p.target, p.weight);
+        layer.image = region;
+        layer.offset = origin + rect.topLeft();
+        layer.phase = rect.topLeft();
+    }
+    return layer;
+}
+
+void Render::orderedDither(QImage &image, const QPoint &phase, int levels)
+{
+    int steps = levels - 1;
+    if (steps < 1)
+        return;
+    for (int y = 0; y < image.height(); y++) {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        const int *row = ditherMap[(y + phase.y()) & 7];
+        for (int x = 0; x < image.width(); x++) {
+            int threshold = row[(x + phase.x()) & 7];
+            QRgb px = line[x];
+            line[x] = qRgba(ditherChannel(qRed(px), steps, threshold),
+                            ditherChannel(qGreen(px), steps, threshold),
+                            ditherChannel(qBlue(px), steps, threshold),
+                            qAlpha(px));
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Composite kernels.  Blend mode, source alpha and dither are template
+// parameters, so each combination compiles to its own branch-free row
+// loop, and composite() picks one from the table once per render.  The
+// arithmetic is QPainter's for an opaque destination: premultiply, then
+// s + d(1-sa) for over and sd + d(1-sa) for multiply, all in /255 steps.
+
+enum Blend { OverBlend, MultiplyBlend };
+
+// ditherChannel for every threshold and value
+struct DitherTable {
+    quint8 level[64][256];
+};
+
+typedef void (*CompositeRow)(QRgb *dst, const QRgb *src, int count,
+                             const DitherTable *dither, const int *thresholds,
+                             int phase);
+
+static inline quint32 div255(quint32 x)
+{
+    return (x + (x >> 8) + 0x80) >> 8;
+}
+
+static const DitherTable *ditherTable(int levels)
+{
+    static QMutex mutex;
+    static QHash<int, QSharedPointer<DitherTable>> tables;
+    QMutexLocker lock(&mutex);
+    QSharedPointer<DitherTable> &table = tables[levels];
+    if (!table) {
+        table.reset(new DitherTable);
+        for (int t = 0; t < 64; t++)
+            for (int v = 0; v < 256; v++)
+                table->level[t][v] = quint8(ditherChannel(v, levels - 1, t + 1));
+    }
+    return table.data();
+}
+
+template <Blend blend, bool alpha, bool dither>
+static void compositeRow(QRgb *dst, const QRgb *src, int count,
+                         const DitherTable *table, const int *thresholds,
+                         int phase)
+{
+    for (int x = 0; x < count; x++) {
+        QRgb s = src[x];
+        quint32 r = qRed(s), g = qGreen(s), b = qBlue(s);
+        if (dither) {
+            const quint8 *level = table->level[thresholds[(x + phase) & 7] - 1];
+            r = level[r];
+            g = level[g];
+            b = level[b];
+        }
+        quint32 a = alpha ? quint32(qAlpha(s)) : 255;
+        if (alpha) {
+            r = div255(r * a);
+            g = div255(g * a);
+            b = div255(b * a);
+        }
+        QRgb d = dst[x];
+        quint32 dr = qRed(d), dg = qGreen(d), db = qBlue(d);
+        if (blend == MultiplyBlend) {
+            r = div255(r * dr + dr * (255 - a));
+            g = div255(g * dg + dg * (255 - a));
+            b = div255(b * db + db * (255 - a));
+        } else if (alpha) {
+            r += div255(dr * (255 - a));
+            g += div255(dg * (255 - a));
+            b += div255(db * (255 - a));
+        }
+        dst[x] = 0xff000000u | r << 16 | g << 8 | b;
+    }
+}
+
+// [blend][alpha][dither]
+static const CompositeRow compositeKernels[2][2][2] = {
+    { { compositeRow<OverBlend, false, false>,
+        compositeRow<OverBlend, false, true> },
+      { compositeRow<OverBlend, true, false>,
+        compositeRow<OverBlend, true, true> } },
+    { { compositeRow<MultiplyBlend, false, false>,
+        compositeRow<MultiplyBlend, false, true> },
+      { compositeRow<MultiplyBlend, true, false>,
+        compositeRow<MultiplyBlend, true, true> } }
+};
+
+QImage Render::composite(const Layer &layer, const Params &p, bool dither)
+{
+    QImage canvas = FramePool::instance()->acquire(p.target,
+                                                   QImage::Format_RGB32);
+    canvas.fill(p.bgcolor);
+    QImage source = toWorkingFormat(layer.image);
+    QRect area = QRect(layer.offset, source.size()) & canvas.rect();
+    if (area.isEmpty())
+        return canvas;
+
+    // dither before multiply to reduce banding
+    int levels = p.multiply && dither ? ditherLevels(p.bgcolor) : 0;
+    dither = levels > 1;
+    const DitherTable *table = dither ? ditherTable(levels) : nullptr;
+    CompositeRow kernel = compositeKernels[p.multiply][source.hasAlphaChannel()][dither];
+    QPoint from = area.topLeft() - layer.offset;
+    for (int y = 0; y < area.height(); y++) {
+        int sy = from.y() + y;
+        kernel(reinterpret_cast<QRgb*>(canvas.scanLine(area.y() + y)) + area.x(),
+               reinterpret_cast<const QRgb*>(source.constScanLine(sy)) + from.x(),
+               area.width(), table, ditherMap[(sy + layer.phase.y()) & 7],
+               from.x() + layer.phase.x());
+    }
+    return canvas;
+}
+
+QImage Render::compositeGeneric(const Layer &layer, const Params &p)
+{
+    Layer dithered = layer;
+    if (p.multiply) {
+        dithered.image = toWorkingFormat(layer.image).copy();
+        orderedDither(dithered.image, layer.phase, ditherLevels(p.bgcolor));
+    }
+    // an opaque canvas, so RGB32 composites the same as premultiplied
+    QImage canvas(p.target, QImage::Format_RGB32);
+    canvas.fill(p.bgcolor);
+    QPainter painter(&canvas);
+    painter.setCompositionMode(p.multiply ? QPainter::CompositionMode_Multiply
+                                          : QPainter::CompositionMode_SourceOver);
+    painter.drawImage(layer.offset, dithered.image);
+    painter.end();
+    return canvas;
+}
+
+QImage Render::renderNative(const QImage &source, const Params &p)
+{
+    if (source.isNull() || p.target.isEmpty())
+        return QImage();
+    return composite(placeLayer(toWorkingFormat(source), p), p);
+}
+
+QImage Render::renderPreview(const QString &srcfname, const Params &params)
+{
+    Params p = focused(srcfname, params);
+    if ((p.scale != ScaledProportions && p.scale != ScaledCropped)
+            || p.target.isEmpty())
+        return QImage();
+    QImageReader reader(srcfname);
+    QSize full = reader.size();
+    // huge sources have nothing cheaper than the real render
+    if (!full.isValid() || isHugeSource(full, p))
+        return QImage();
+    QSize size = fitSize(full, p.target, p.scale == ScaledCropped);
+    QSize decoded = size / previewReduction;
+    // a pyramid level, where there is one, beats even a shrinking decoder
+    QImage image = Pyramid::lookup(srcfname, full, decoded);
+    if (image.isNull()) {
+        if (!decoded.isEmpty() && decoded.width() < full.width()) {
+            reader.setScaledSize(decoded);
+            reader.setQuality(0);   // the cheap path where the plugin has one
+        }
+        if (!reader.read(&image))
+            return QImage();
+    }
+    image = toWorkingFormat(image).scaled(size, Qt::IgnoreAspectRatio,
+                                          Qt::SmoothTransformation);
+    Layer layer;
+    if (p.scale == ScaledCropped) {
+        QPoint crop = cropOrigin(size, p);
+        layer.image = copyRect(image, QRect(crop, p.target));
+    } else {
+        layer.image = image;
+        layer.offset = gravityOffset(size, p.target, p.weight);
+    }
+    return composite(layer, p, false);
+}
+
+//----------------------------------------------------------------------------
+
+// originals bigger than this (a 48 megapixel photo) are decoded again
+// rather than kept between renders; pyramid levels are bounded by the
+// target already and always kept
+static const qint64 maxKeptSourceBytes = 192 << 20;
+
+// A file by path, size and modification time, so one rewritten in place
+// (the web and archive sources reuse their scratch names) is new to us.
+static QString sourceIdentity(const QString &srcfname)
+{
+    QFileInfo info(srcfname);
+    return QString("%1|%2|%3").arg(srcfname).arg(info.size())
+            .arg(info.lastModified().toMSecsSinceEpoch());
+}
+
+// Size a source has to have at least for the layer to be scaled down from
+// it; empty when only the original will do.
+static QSize coverSize(const QSize &full, const Params &p)
+{
+    if (!full.isValid()
+            || (p.scale != ScaledProportions && p.scale != ScaledCropped))
+        return QSize();
+    return fitSize(full, p.target, p.scale == ScaledCropped);
+}
+
+// The part of the source to decode: what is visible of an unscaled source
+// bigger than the target, and the crop of a huge one scaled to cover it.
+// Null when the whole source is wanted.
+static QRect decodedRegion(const QSize &full, const Params &p)
+{
+    if (!full.isValid()
+            || !(p.scale == NotScaled || isHugeSource(full, p)))
+        return QRect();
+    QRect rect = visibleSourceRect(full, p);
+    return rect == QRect(QPoint(0,0), full) ? QRect() : rect;
+}
+
+// Unscaled regions are decoded as they are; scaled ones at twice the size
+// they take on the layer, so the decoder can shrink them on the way.
+static QSize regionDecodeSize(const QRect &region, const QSize &full,
+                              const Params &p)
+{
+    if (p.scale != ScaledCropped)
+        return region.size();
+    QSize size = fitSize(full, p.target, true);
+    QSize onLayer(int(std::ceil(2.0 * region.width() * size.width() / full.width())),
+                  int(std::ceil(2.0 * region.height() * size.height() / full.height())));
+    return onLayer.boundedTo(region.size());
+}
+
+Engine::Engine() : sourceReduced(false), hasLayer(false)
+{
+
+}
+
+QImage Engine::render(const QString &srcfname, const Params &p)
+{
+    QMutexLocker lock(&mutex);
+    QString identity = sourceIdentity(srcfname);
+    if (identity != sourceId) {
+        sourceId = identity;
+        source = QImage();
+        sourceReduced = false;
+        hasLayer = false;
+    }
+    if (!hasLayer || !layerParams.sameGeometry(p)) {
+        Params placed = focused(srcfname, p);
+        // start from the smallest pyramid level that covers the target
+        QSize full = Catalog::instance()->imageSize(srcfname);
+        QSize cover = coverSize(full, p);
+        if (sourceReduced && (cover.isEmpty()
+                              || source.width() < cover.width()
+                              || source.height() < cover.height()))
+            source = QImage();
+        // cropped sources not already at hand only have their visible part
+        // decoded, however big they are
+        QRect region = source.isNull() ? decodedRegion(full, placed) : QRect();
+        if (!region.isNull()) {
+            QImage part = loadRegion(srcfname, region,
+                                     regionDecodeSize(region, full, placed));
+            Metrics::add("render/regions");
+            if (part.isNull())
+                return QImage();
+            layer = placeRegion(part, region, full, placed);
+        } else {
+            if (source.isNull() && !cover.isEmpty()) {
+                source = Pyramid::lookup(srcfname, full, cover);
+                sourceReduced = !source.isNull();
+            }
+            if (source.isNull()) {
+                source = loadImage(srcfname);
+                sourceReduced = false;
+                Metrics::add("render/decodes");
+                if (!cover.isEmpty() && !source.isNull()) {
+                    QImage level = Pyramid::build(srcfname, source, cover);
+                    sourceReduced = level.size() != source.size();
+                    source = level;
+                }
+            }
+            if (source.isNull())
+                return QImage();
+            layer = placeLayer(source, placed);
+            if (!sourceReduced && source.sizeInBytes() > maxKeptSourceBytes)
+                source = QImage();
+        }
+        layerParams = p;
+        hasLayer = true;
+        Metrics::add("render/layouts");
+    }
+    Metrics::add("render/composites");
+    return composite(layer, p);
+}
+
+void Engine::clear()
+{
+    QMutexLocker lock(&mutex);
+    sourceId.clear();
+    source = QImage();
+    sourceReduced = false;
+    layer = Layer();
+    hasLayer = false;
+}
@@ -0,0 +1,143 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <QColor>
+#include <QImage>
+#include <QMutex>
+#include <QPoint>
+#include <QPointF>
+#include <QRect>
+#include <QSize>
+#include <QStringList>
+#include "dialogdata.h"
+
+namespace Render {
+
+//----------------------------------------------------------------------------
+
+// The subset of dialogdata that decides what a wallpaper looks like.
+struct Params {
+    QSize target;
+    Scaling scale;
+    Gravity weight;
+    QColor bgcolor;
+    bool multiply;
+    Filter filter;
+    int tiles;          // for Mosaic
+    // the source's subject, as fractions of its size, for Automatic crops;
+    // filled in per source by the renderers
+    QPointF focus;
+
+    Params() : target(1920,1080), scale(ScaledProportions),
+        weight(SouthEast), bgcolor(48,48,48), multiply(true),
+        filter(AutomaticFilter), tiles(12), focus(0.5, 0.5) { }
+    explicit Params(const dialogdata &d) : target(d.target), scale(d.scale),
+        weight(d.weight), bgcolor(d.bgcolor), multiply(d.multiply),
+        filter(d.filter), tiles(d.mosaicTiles), focus(0.5, 0.5) { }
+    QString targetString() const;
+    // true if a layer placed for one fits the other
+    bool sameGeometry(const Params &other) const;
+    bool operator==(const Params &other) const;
+};
+
+//----------------------------------------------------------------------------
+
+// Arguments for imagemagick's convert to render srcfname into destfname.
+// Automatic crops use the focus in the catalog and never decode for it, so
+// unless Catalog::cropFocus has been called first they are centred.
+QStringList convertArguments(const QString &srcfname, const QString &destfname,
+                             const Params &p);
+// Size of the odd-count tile grid that covers the target.
+QString calcTileSize(const QString &srcfname, const Params &p);
+
+//----------------------------------------------------------------------------
+
+// The in-process renderer.  It follows the convert pipeline above step by
+// step, so the two can be compared pixel for pixel (see bench --compare).
+
+// The scaled, cropped or tiled source as it lands on the target.
+struct Layer {
+    QImage image;   // only the part of the layer that is on the target
+    QPoint offset;  // where image goes on the target
+    QPoint phase;   // where image starts within the whole layer
+};
+
+// Top-left corner of a layer placed on the target, as convert's -gravity.
+QPoint gravityOffset(const QSize &layer, const QSize &target, Gravity g);
+// Top-left corner of the target-sized window cut from a source scaled to
+// cover it: the middle, or around p.focus with Automatic gravity.
+QPoint cropOrigin(const QSize &size, const Params &p);
+// Size convert's -resize gives, to fit (WxH) or to cover (WxH^).
+QSize fitSize(const QSize &source, const QSize &target, bool cover);
+QImage loadImage(const QString &fname);
+// Just rect of the file, decoded at size (rect's own size for no scaling).
+QImage loadRegion(const QString &fname, const QRect &rect, const QSize &size);
+
+// Scaling happens in linear light, like convert's -colorspace RGB, but with
+// 16 bits per channel and lookup tables instead of floats, and goes through
+// the threaded resampler in resample.h.  toLinear gives
+// premultiplied RGBA64; fromLinear goes back to RGB32 or ARGB32.
+quint16 srgbToLinear(quint8 value);
+quint8 linearToSrgb(quint16 value);
+QImage toLinear(const QImage &image);
+QImage fromLinear(const QImage &linear, QImage::Format format);
+QImage scaleLinear(const QImage &image, const QSize &size,
+                   Filter filter = AutomaticFilter);
+
+Layer placeLayer(const QImage &source, const Params &p);
+// Unscaled and cropped sources so much bigger than the target that they
+// are only ever decoded in part, convert being no option for them.
+bool isHugeSource(const QSize &full, const Params &p);
+// The part of a source of size full that reaches the target, unscaled or
+// scaled to cover (with a margin for the filter); all of it otherwise.
+QRect visibleSourceRect(const QSize &full, const Params &p);
+// placeLayer for when only rect of the source was decoded, at any size.
+Layer placeRegion(const QImage &region, const QRect &rect, const QSize &full,
+                  const Params &p);
+// Same as convert's -ordered-dither 8x8,levels on the colour channels.
+void orderedDither(QImage &image, const QPoint &phase, int levels);
+// The layer on the background, dithered first when multiplying (unless
+// dither is false), through a kernel specialised for the blend, the
+// source's alpha and the dither.
+QImage composite(const Layer &layer, const Params &p, bool dither = true);
+// The same with orderedDither and QPainter: the reference composite() is
+// checked and timed against by bench --kernels.
+QImage compositeGeneric(const Layer &layer, const Params &p);
+QImage renderNative(const QImage &source, const Params &p);
+// A rough renderNative straight from the file, for showing something while
+// the real one renders: the decoder shrinks the image (JPEG does it almost
+// for free) and Qt's bilinear scaler brings it to size, composited without
+// dither as it is only up for a moment.  Null for the
+// unscaled modes, which have no cheap way to get there.
+QImage renderPreview(const QString &srcfname, const Params &p);
+
+//----------------------------------------------------------------------------
+
+// renderNative with a memory: the last decoded source and its placed layer
+// are kept, so rendering the same file again only redoes the steps whose
+// settings changed.  Colour, dither and compose changes just composite
+// again; geometry changes start over from the decoded source.  Scaled
+// modes decode through the pyramid (pyramid.h), so the source may be a
+// reduced level of the original.
+class Engine
+{
+public:
+    Engine();
+    QImage render(const QString &srcfname, const Params &p);
+    void clear();
+
+private:
+    QMutex mutex;
+    QString sourceId;       // path, size and mtime
+    QImage source;
+    bool sourceReduced;
+    Params layerParams;
+    Layer layer;
+    bool hasLayer;
+};
+
+//----------------------------------------------------------------------------
+
+}
+
+#endif // RENDER_H
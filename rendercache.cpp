@@ -0,0 +1,306 @@
+#include "rendercache.h"
+#include "framepool.h"
+#include "metrics.h"
+#include "catalog.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QTextStream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <grp.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// shared only if the admin made it: owned by root, sticky and open to all
+static const char sharedFolder[] = "/dev/shm/qt314wall-cache";
+// ours alone otherwise, with the uid appended
+static const char privateFolderPrefix[] = "/dev/shm/qt314wall-cache-";
+static const char indexName[] = "index";
+static const quint32 frameMagic = 0x33313466;      // "f413"
+// shared by every user, about a dozen 4K frames
+static const qint64 cacheBudget = qint64(384) << 20;
+// frames of other users are only trusted from members of this group, if
+// the admin has made one
+static const char sharedGroup[] = "qt314wall";
+
+struct FrameHeader {
+    quint32 magic;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    qint32 format;
+};
+
+// Keys are SHA-1 digests; anything else in the shared index is someone
+// trying to make us remove files outside the folder.
+static bool validKey(const QString &key)
+{
+    static const QRegularExpression digest("^[0-9a-f]{40}$");
+    return digest.match(key).hasMatch();
+}
+
+// The shared folder if it is a real directory the admin set up, or our
+// own if it is a real directory only we can write to; empty if neither
+// can be had.  Both are checked without following links, so nobody can
+// point us somewhere else by creating them first.
+static QString cacheFolder()
+{
+    struct stat st;
+    if (lstat(sharedFolder, &st) == 0 && S_ISDIR(st.st_mode)
+            && st.st_uid == 0 && (st.st_mode & 07777) == 01777)
+        return sharedFolder;
+    QString own = privateFolderPrefix + QString::number(getuid());
+    QByteArray path = QFile::encodeName(own);
+    if (mkdir(path.constData(), 0700) != 0 && errno != EEXIST)
+        return QString();
+    if (lstat(path.constData(), &st) != 0 || !S_ISDIR(st.st_mode)
+            || st.st_uid != getuid() || (st.st_mode & 0077)) {
+        Metrics::add("rendercache/badFolder");
+        return QString();
+    }
+    return own;
+}
+
+static QString framePath(const QString &folder, const QString &key)
+{
+    return QString("%1/%2.frame").arg(folder, key);
+}
+
+// Opens path without following a link, and without blocking on a fifo.
+static bool openNoFollow(QFile &f, const QString &path, int flags,
+                         QIODevice::OpenMode mode)
+{
+    int fd = open(QFile::encodeName(path).constData(),
+                  flags | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return false;
+    if (!f.open(fd, mode, QFileDevice::AutoCloseHandle)) {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+// The shared group's id if it exists and we are in it, -1 otherwise.
+static gid_t sharingGroup()
+{
+    struct group *g = getgrnam(sharedGroup);
+    if (!g)
+        return gid_t(-1);
+    if (getegid() == g->gr_gid)
+        return g->gr_gid;
+    gid_t groups[256];
+    int count = getgroups(256, groups);
+    for (int i = 0; i < count; i++)
+        if (groups[i] == g->gr_gid)
+            return g->gr_gid;
+    return gid_t(-1);
+}
+
+// Anyone can put frames in the folder, under any key: only our own and
+// those of the sharing group are taken.
+static bool trusted(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    if (st.st_uid == getuid())
+        return true;
+    gid_t shared = sharingGroup();
+    return shared != gid_t(-1) && st.st_gid == shared;
+}
+
+QString RenderCache::key(const QString &srcfname, const Render::Params &p,
+                         bool native)
+{
+    // an Automatic crop is cut around the subject, which has to be known
+    // before the render can be told apart from others
+    QString focus;
+    if (p.scale == ScaledCropped && p.weight == Automatic) {
+        QPointF f;
+        if (!Catalog::instance()->knownFocus(srcfname, &f))
+            return QString();
+        focus = QString("%1,%2").arg(f.x()).arg(f.y());
+    }
+    QFileInfo info(srcfname);
+    QString id = QString("%1|%2|%3|%4|%5|%6|%7|%8|%9|%10|%11")
+            .arg(info.canonicalFilePath())
+            .arg(info.size())
+            .arg(info.lastModified().toMSecsSinceEpoch())
+            .arg(p.targetString())
+            .arg(p.scale)
+            .arg(p.weight)
+            .arg(p.bgcolor.name())
+            .arg(p.multiply)
+            .arg(p.filter)
+            .arg(native)
+            .arg(focus);
+    return QCryptographicHash::hash(id.toUtf8(),
+                                    QCryptographicHash::Sha1).toHex();
+}
+
+bool RenderCache::contains(const QString &key)
+{
+    if (key.isEmpty())
+        return false;
+    QString folder = cacheFolder();
+    return !folder.isEmpty() && QFileInfo::exists(framePath(folder, key));
+}
+
+QImage RenderCache::lookup(const QString &key, const QSize &size)
+{
+    // an evicted file stays readable while we have it open
+    QString folder = cacheFolder();
+    if (key.isEmpty() || folder.isEmpty())
+        return QImage();
+    QFile f;
+    if (!openNoFollow(f, framePath(folder, key), O_RDONLY, QIODevice::ReadOnly)) {
+        Metrics::add("rendercache/misses");
+        return QImage();
+    }
+    if (!trusted(f.handle())) {
+        Metrics::add("rendercache/untrusted");
+        return QImage();
+    }
+    // nothing is allocated for a header that does not describe the frame
+    // we want
+    FrameHeader h;
+    if (f.read(reinterpret_cast<char*>(&h), sizeof(h)) != sizeof(h)
+            || h.magic != frameMagic || QSize(h.width, h.height) != size
+            || size.isEmpty()
+            || h.format <= QImage::Format_Invalid
+            || h.format >= QImage::NImageFormats) {
+        Metrics::add("rendercache/misses");
+        return QImage();
+    }
+    QImage frame = FramePool::instance()->acquire(size, QImage::Format(h.format));
+    if (frame.isNull() || h.bytesPerLine != frame.bytesPerLine()) {
+        Metrics::add("rendercache/misses");
+        return QImage();
+    }
+    int lineBytes = h.bytesPerLine;
+    for (int y = 0; y < h.height; y++) {
+        if (f.read(reinterpret_cast<char*>(frame.scanLine(y)), lineBytes) != lineBytes) {
+            Metrics::add("rendercache/misses");
+            return QImage();
+        }
+    }
+    // the modification time doubles as the last use, for eviction; this
+    // only works on our own frames, others age by their owners' use
+    futimens(f.handle(), nullptr);
+    Metrics::add("rendercache/hits");
+    return frame;
+}
+
+// Under the index lock: record key, then drop the oldest frames we are
+// allowed to until the cache fits its budget again.
+static void updateIndex(QFile &index, const QString &folder,
+                        const QString &key, qint64 bytes)
+{
+    struct Entry {
+        QString key;
+        qint64 bytes;
+        qint64 used;
+    };
+    QList<Entry> entries;
+    QTextStream in(&index);
+    while (!in.atEnd()) {
+        QStringList fields = in.readLine().split(' ');
+        if (fields.count() != 2 || fields[0] == key || !validKey(fields[0]))
+            continue;
+        QFileInfo info(framePath(folder, fields[0]));
+        if (info.exists())
+            entries.append(Entry { fields[0], fields[1].toLongLong(),
+                                   info.lastModified().toMSecsSinceEpoch() });
+    }
+    entries.append(Entry { key, bytes, QDateTime::currentMSecsSinceEpoch() });
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.used < b.used;
+    });
+    qint64 total = 0;
+    for (const Entry &e : entries)
+        total += e.bytes;
+    for (int i = 0; i < entries.count() - 1 && total > cacheBudget; ) {
+        if (QFile::remove(framePath(folder, entries[i].key))) {
+            total -= entries[i].bytes;
+            entries.removeAt(i);
+            Metrics::add("rendercache/evictions");
+        } else {
+            i++;    // someone else's
+        }
+    }
+
+    index.resize(0);
+    index.seek(0);
+    QTextStream out(&index);
+    for (const Entry &e : entries)
+        out << e.key << ' ' << e.bytes << '\n';
+    out.flush();
+    index.flush();
+    Metrics::set("rendercache/bytes", total);
+}
+
+bool RenderCache::store(const QString &key, const QImage &frame)
+{
+    if (!validKey(key) || frame.isNull())
+        return false;
+    QString folder = cacheFolder();
+    if (folder.isEmpty())
+        return false;
+    // a fresh file under a name nobody can guess or plant ahead of us
+    QByteArray partName = QFile::encodeName(QString("%1/.%2.XXXXXX")
+                                            .arg(folder, key));
+    int fd = mkstemp(partName.data());
+    if (fd < 0)
+        return false;
+    QFile part;
+    if (!part.open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
+        close(fd);
+        unlink(partName.constData());
+        return false;
+    }
+    FrameHeader h = { frameMagic, frame.width(), frame.height(),
+                      frame.bytesPerLine(), frame.format() };
+    bool ok = part.write(reinterpret_cast<const char*>(&h), sizeof(h)) == sizeof(h);
+    for (int y = 0; ok && y < frame.height(); y++)
+        ok = part.write(reinterpret_cast<const char*>(frame.constScanLine(y)),
+                        frame.bytesPerLine()) == frame.bytesPerLine();
+    qint64 bytes = part.size();
+    // let the sharing group's members use it; ours either way
+    gid_t shared = sharingGroup();
+    if (shared != gid_t(-1) && fchown(part.handle(), uid_t(-1), shared) != 0)
+        Metrics::add("rendercache/unshared");
+    fchmod(part.handle(), 0644);
+    part.close();
+    if (!ok || rename(partName.constData(),
+                      QFile::encodeName(framePath(folder, key)).constData()) != 0) {
+        unlink(partName.constData());
+        return false;
+    }
+
+    // the frame is usable even if it cannot be indexed
+    QFile index;
+    if (!openNoFollow(index, QString("%1/%2").arg(folder, indexName),
+                      O_RDWR | O_CREAT, QIODevice::ReadWrite))
+        return true;
+    struct stat st;
+    if (fstat(index.handle(), &st) != 0 || !S_ISREG(st.st_mode))
+        return true;
+    // whoever makes the shared index first has to let everyone write it
+    if (st.st_size == 0 && folder == sharedFolder)
+        fchmod(index.handle(), 0666);
+    flock(index.handle(), LOCK_EX);
+    updateIndex(index, folder, key, bytes);
+    flock(index.handle(), LOCK_UN);
+    Metrics::add("rendercache/stores");
+    return true;
+}
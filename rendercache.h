@@ -0,0 +1,31 @@
+#ifndef RENDERCACHE_H
+#define RENDERCACHE_H
+
+#include <QImage>
+#include <QString>
+#include "render.h"
+
+// Finished wallpapers (before overlays) kept in /dev/shm, shared by every
+// qt314wall on the machine where the admin has made the shared folder, per
+// user otherwise.  Frames are stored raw, one file per key, and appear
+// atomically by rename, so lookups take no lock.  Stores go through an
+// index guarded by flock, which also evicts the least recently used
+// frames once the cache outgrows its budget.  The shared folder is sticky
+// like /tmp: anyone can add frames, but only their owner can evict them,
+// and lookups only trust our own frames and those of the members of the
+// "qt314wall" group, where the admin has set one up.
+namespace RenderCache {
+
+// Identifies a render of srcfname: the file by path, size and mtime, and
+// every setting that changes the result, the subject of an Automatic crop
+// included.  native tells the renderers apart.  Empty while that subject
+// is not known yet, which makes the render uncacheable.
+QString key(const QString &srcfname, const Render::Params &p, bool native);
+bool contains(const QString &key);
+// The frame if it is there, trusted and of the given size.
+QImage lookup(const QString &key, const QSize &size);
+bool store(const QString &key, const QImage &frame);
+
+}
+
+#endif // RENDERCACHE_H
@@ -0,0 +1,259 @@
+#include "resample.h"
+#include "framepool.h"
+#include "priority.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QThread>
+#include <QVector>
+#include <algorithm>
+#include <cmath>
+
+using namespace Render;
+
+// weights are fixed point with this many fractional bits
+static const int weightBits = 12;
+static const int weightOne = 1 << weightBits;
+// rows per job, small enough to balance across cores
+static const int rowsPerJob = 16;
+// weight tables kept, which covers a few screens and their sources
+static const int maxCachedTables = 32;
+
+struct WeightTable {
+    int taps;
+    QVector<int> first;     // first source index per target index
+    QVector<qint32> weights;  // taps weights per target index
+};
+typedef QSharedPointer<const WeightTable> WeightTablePtr;
+
+struct RowRange {
+    int begin, end;
+};
+
+//----------------------------------------------------------------------------
+
+static double sinc(double x)
+{
+    if (x == 0)
+        return 1;
+    x *= M_PI;
+    return std::sin(x) / x;
+}
+
+static double filterSupport(Filter filter)
+{
+    switch (filter) {
+    case Bilinear:  return 1;
+    case Mitchell:  return 2;
+    case Lanczos3:
+    default:        return 3;
+    }
+}
+
+static double filterWeight(Filter filter, double x)
+{
+    x = std::abs(x);
+    switch (filter) {
+    case Bilinear:
+        return x < 1 ? 1 - x : 0;
+    case Mitchell: {
+        // B = C = 1/3
+        const double B = 1 / 3.0, C = 1 / 3.0;
+        if (x < 1)
+            return ((12 - 9*B - 6*C) * x*x*x + (-18 + 12*B + 6*C) * x*x
+                    + (6 - 2*B)) / 6;
+        if (x < 2)
+            return ((-B - 6*C) * x*x*x + (6*B + 30*C) * x*x
+                    + (-12*B - 48*C) * x + (8*B + 24*C)) / 6;
+        return 0;
+    }
+    case Lanczos3:
+    default:
+        return x < 3 ? sinc(x) * sinc(x / 3) : 0;
+    }
+}
+
+static WeightTablePtr buildTable(int source, int target, Filter filter)
+{
+    WeightTable *t = new WeightTable;
+    double scale = double(target) / source;
+    // when shrinking, stretch the kernel to cover every source sample
+    double stretch = std::max(1.0, 1 / scale);
+    double support = filterSupport(filter) * stretch;
+    t->taps = std::min(source, int(std::ceil(support * 2)) + 1);
+    t->first.resize(target);
+    t->weights.fill(0, target * t->taps);
+
+    QVector<double> w(t->taps);
+    for (int i = 0; i < target; i++) {
+        double centre = (i + 0.5) / scale;
+        int left = std::max(0, int(std::floor(centre - support)));
+        int right = std::min(source, int(std::ceil(centre + support)));
+        right = std::min(right, left + t->taps);
+        // every target index reads a full run of taps, so keep that run
+        // inside the source; the spare taps get zero weight
+        int first = std::min(left, source - t->taps);
+        double sum = 0;
+        for (int j = left; j < right; j++) {
+            w[j - left] = filterWeight(filter, (j + 0.5 - centre) / stretch);
+            sum += w[j - left];
+        }
+        // renormalize so the edges keep their brightness, and push the
+        // rounding error into the largest weight so every row sums to one
+        qint32 *out = t->weights.data() + i * t->taps;
+        int total = 0, largest = left - first;
+        for (int j = left; j < right; j++) {
+            int k = j - first;
+            out[k] = qint32(std::lround(w[j - left] / (sum ? sum : 1) * weightOne));
+            total += out[k];
+            if (out[k] > out[largest])
+                largest = k;
+        }
+        out[largest] += weightOne - total;
+        t->first[i] = first;
+    }
+    return WeightTablePtr(t);
+}
+
+static WeightTablePtr weightTable(int source, int target, Filter filter)
+{
+    static QMutex mutex;
+    static QHash<quint64, WeightTablePtr> cache;
+    quint64 key = (quint64(source) << 34) | (quint64(target) << 4) | quint64(filter);
+
+    QMutexLocker lock(&mutex);
+    WeightTablePtr t = cache.value(key);
+    if (t)
+        return t;
+    if (cache.count() >= maxCachedTables)
+        cache.clear();
+    t = buildTable(source, target, filter);
+    cache.insert(key, t);
+    return t;
+}
+
+// Fits comfortably: 16-bit samples times weights summing to 4096, with the
+// largest negative or positive lobe sum well under two.
+static inline quint16 clamp16(qint32 v)
+{
+    v = (v + (weightOne >> 1)) >> weightBits;
+    return quint16(v < 0 ? 0 : v > 65535 ? 65535 : v);
+}
+
+//----------------------------------------------------------------------------
+
+static void horizontalRows(const QImage &in, QImage &out,
+                           const WeightTable &t, const RowRange &rows)
+{
+    int width = out.width();
+    for (int y = rows.begin; y < rows.end; y++) {
+        const quint16 *src = reinterpret_cast<const quint16*>(in.constScanLine(y));
+        quint16 *dst = reinterpret_cast<quint16*>(out.scanLine(y));
+        for (int x = 0; x < width; x++) {
+            const qint32 *w = t.weights.constData() + x * t.taps;
+            const quint16 *s = src + t.first[x] * 4;
+            qint32 acc[4] = { 0, 0, 0, 0 };
+            for (int k = 0; k < t.taps; k++)
+                for (int c = 0; c < 4; c++)
+                    acc[c] += w[k] * s[k*4 + c];
+            for (int c = 0; c < 4; c++)
+                dst[x*4 + c] = clamp16(acc[c]);
+        }
+    }
+}
+
+static void verticalRows(const QImage &in, QImage &out,
+                         const WeightTable &t, const RowRange &rows)
+{
+    // whole rows at a time, so each tap streams through memory in order
+    int channels = out.width() * 4;
+    QVector<qint32> acc(channels);
+    for (int y = rows.begin; y < rows.end; y++) {
+        std::fill(acc.begin(), acc.end(), 0);
+        const qint32 *w = t.weights.constData() + y * t.taps;
+        qint32 *a = acc.data();
+        for (int k = 0; k < t.taps; k++) {
+            if (!w[k])
+                continue;
+            const quint16 *src = reinterpret_cast<const quint16*>(
+                        in.constScanLine(t.first[y] + k));
+            qint32 wk = w[k];
+            for (int i = 0; i < channels; i++)
+                a[i] += wk * src[i];
+        }
+        quint16 *dst = reinterpret_cast<quint16*>(out.scanLine(y));
+        for (int i = 0; i < channels; i++)
+            dst[i] = clamp16(a[i]);
+    }
+}
+
+template <class Pass>
+static void runRows(int height, Pass pass)
+{
+    QVector<RowRange> jobs;
+    for (int y = 0; y < height; y += rowsPerJob)
+        jobs.append({ y, std::min(height, y + rowsPerJob) });
+    Priority::blockingMap(jobs.count(), [&pass, &jobs](int i) {
+        pass(jobs.at(i));
+    });
+}
+
+static QImage horizontal(const QImage &in, int width, Filter filter)
+{
+    if (in.width() == width)
+        return in;
+    WeightTablePtr t = weightTable(in.width(), width, filter);
+    QImage out = FramePool::instance()->acquire(QSize(width, in.height()),
+                                                in.format());
+    runRows(in.height(), [&](const RowRange &rows) {
+        horizontalRows(in, out, *t, rows);
+    });
+    return out;
+}
+
+static QImage vertical(const QImage &in, int height, Filter filter)
+{
+    if (in.height() == height)
+        return in;
+    WeightTablePtr t = weightTable(in.height(), height, filter);
+    QImage out = FramePool::instance()->acquire(QSize(in.width(), height),
+                                                in.format());
+    runRows(height, [&](const RowRange &rows) {
+        verticalRows(in, out, *t, rows);
+    });
+    return out;
+}
+
+//----------------------------------------------------------------------------
+
+QImage Render::resample(const QImage &linear, const QSize &size, Filter filter)
+{
+    if (linear.size() == size || size.isEmpty())
+        return linear;
+    if (filter == AutomaticFilter)
+        filter = automaticFilter(linear.size(), size, true);
+
+    // cost of each order in multiply-adds, give or take the tap counts
+    double taps = filterSupport(filter) * 2;
+    double sx = std::max(1.0, double(linear.width()) / size.width());
+    double sy = std::max(1.0, double(linear.height()) / size.height());
+    double horizontalFirst = double(linear.height()) * size.width() * taps * sx
+            + double(size.width()) * size.height() * taps * sy;
+    double verticalFirst = double(size.height()) * linear.width() * taps * sy
+            + double(size.width()) * size.height() * taps * sx;
+
+    if (horizontalFirst <= verticalFirst)
+        return vertical(horizontal(linear, size.width(), filter),
+                        size.height(), filter);
+    return horizontal(vertical(linear, size.height(), filter),
+                      size.width(), filter);
+}
+
+Filter Render::automaticFilter(const QSize &source, const QSize &target,
+                               bool alpha)
+{
+    bool enlarging = target.width() > source.width()
+            || target.height() > source.height();
+    return enlarging || alpha ? Mitchell : Lanczos3;
+}
@@ -0,0 +1,23 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <QImage>
+#include <QSize>
+#include "dialogdata.h"
+
+namespace Render {
+
+// Separable resampler for premultiplied RGBA64 images.  Filter weights are
+// cached per (source length, target length, filter) for each axis, and
+// both passes are split by rows across idle threads (Priority::blockingMap).
+// The pass that shrinks the image more runs first so the second one has
+// less to do.
+QImage resample(const QImage &linear, const QSize &size, Filter filter);
+
+// The filter convert would pick: Lanczos to shrink opaque images, Mitchell
+// to enlarge them or for anything with alpha.
+Filter automaticFilter(const QSize &source, const QSize &target, bool alpha);
+
+}
+
+#endif // RESAMPLE_H
@@ -0,0 +1,142 @@
+#include "scheduler.h"
+#include "metrics.h"
+
+#include <QDateTime>
+#include <algorithm>
+
+// weight of the newest latency sample in the moving estimate
+static const double latencyWeight = 0.25;
+// assumed latency before anything has been measured
+static const double initialLatency = 2000;
+// slack on top of the estimate, as a factor and a fixed amount
+static const double leadFactor = 1.25;
+static const qint64 leadMarginMs = 250;
+
+static qint64 now()
+{
+    return QDateTime::currentMSecsSinceEpoch();
+}
+
+Scheduler::Scheduler(QObject *parent) : QObject(parent),
+    interval(0), aligned_(false), active(false), preparing(false), base(0),
+    deadline(0), startedAt(0), latencyEstimate(initialLatency)
+{
+    prepareTimer.setSingleShot(true);
+    prepareTimer.setTimerType(Qt::PreciseTimer);
+    connect(&prepareTimer, &QTimer::timeout,
+            this, &Scheduler::prepareTimer_timeout);
+    publishTimer.setSingleShot(true);
+    publishTimer.setTimerType(Qt::PreciseTimer);
+    connect(&publishTimer, &QTimer::timeout,
+            this, &Scheduler::publishTimer_timeout);
+}
+
+void Scheduler::start(int intervalMs, bool aligned)
+{
+    if (active && interval == intervalMs && aligned_ == aligned)
+        return;
+    stop();
+    interval = intervalMs;
+    aligned_ = aligned;
+    active = true;
+    base = aligned ? 0 : now();
+    deadline = base;
+    advance();
+}
+
+void Scheduler::stop()
+{
+    active = false;
+    preparing = false;
+    prepareTimer.stop();
+    publishTimer.stop();
+}
+
+bool Scheduler::isActive()
+{
+    return active;
+}
+
+QDateTime Scheduler::nextDeadline() const
+{
+    return QDateTime::fromMSecsSinceEpoch(deadline);
+}
+
+bool Scheduler::isPreparing()
+{
+    return preparing;
+}
+
+void Scheduler::rendered()
+{
+    if (!preparing)
+        return;
+    preparing = false;
+    qint64 t = now();
+    latencyEstimate += latencyWeight * ((t - startedAt) - latencyEstimate);
+    Metrics::set("scheduler/latencyEstimateMs", qint64(latencyEstimate));
+    if (t < deadline) {
+        publishTimer.start(int(deadline - t));
+        return;
+    }
+    Metrics::add("scheduler/deadlines");
+    Metrics::add("scheduler/missed");
+    Metrics::set("scheduler/lastLatenessMs", t - deadline);
+    emit publish();
+    advance();
+}
+
+void Scheduler::abandon()
+{
+    // a frame waiting for its deadline goes as well as one still coming
+    if (!preparing && !publishTimer.isActive())
+        return;
+    preparing = false;
+    publishTimer.stop();
+    Metrics::add("scheduler/deadlines");
+    Metrics::add("scheduler/missed");
+    Metrics::add("scheduler/abandoned");
+    advance();
+}
+
+void Scheduler::prepareTimer_timeout()
+{
+    preparing = true;
+    startedAt = now();
+    emit prepare();
+}
+
+void Scheduler::publishTimer_timeout()
+{
+    Metrics::add("scheduler/deadlines");
+    Metrics::set("scheduler/lastLatenessMs", now() - deadline);
+    emit publish();
+    advance();
+}
+
+void Scheduler::advance()
+{
+    if (!active)
+        return;
+    // skip whole periods that have already gone (e.g. after a suspend)
+    // so the schedule keeps its phase instead of drifting
+    qint64 earliest = now() + leadTime();
+    if (deadline < earliest)
+        deadline += ((earliest - deadline) / interval + 1) * interval;
+    else
+        deadline += interval;
+    armPrepare();
+}
+
+void Scheduler::armPrepare()
+{
+    qint64 wait = deadline - leadTime() - now();
+    prepareTimer.start(int(std::max<qint64>(0, wait)));
+}
+
+qint64 Scheduler::leadTime()
+{
+    // never start more than half a period early
+    return std::min<qint64>(interval / 2,
+                            qint64(latencyEstimate * leadFactor) + leadMarginMs);
+}
@@ -0,0 +1,54 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <QDateTime>
+#include <QObject>
+#include <QTimer>
+
+// Keeps wallpaper changes on wall-clock deadlines.  prepare() is emitted
+// early enough, judging by recent fetch+render latency, that the result is
+// ready by the deadline; publish() is then held back until the deadline
+// itself.  Deadlines can be aligned to multiples of the interval since the
+// epoch, so machines with synced clocks change at the same moment.
+class Scheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Scheduler(QObject *parent = nullptr);
+    void start(int intervalMs, bool aligned);
+    void stop();
+    bool isActive();
+    bool isPreparing();
+    // When the frame being prepared will be published.
+    QDateTime nextDeadline() const;
+
+signals:
+    void prepare();
+    void publish();
+
+public slots:
+    void rendered();
+    void abandon();
+
+private slots:
+    void prepareTimer_timeout();
+    void publishTimer_timeout();
+
+private:
+    void advance();
+    void armPrepare();
+    qint64 leadTime();
+
+    QTimer prepareTimer;
+    QTimer publishTimer;
+    int interval;
+    bool aligned_;
+    bool active;
+    bool preparing;
+    qint64 base;
+    qint64 deadline;
+    qint64 startedAt;
+    double latencyEstimate;
+};
+
+#endif // SCHEDULER_H
@@ -1,13 +1,33 @@
 #include "source.h"
+#include "metrics.h"
+#include "catalog.h"
+#include "mirror.h"
 
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QImage>
 #include <QJsonDocument>
 #include <QNetworkReply>
 #include <QUrlQuery>
+#include <QVector>
+#include <QFutureWatcher>
+#include <QSharedPointer>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <zlib.h>
 
 using namespace Sources;
 
+// files each source in a mix keeps fetched ahead
+static const int prefetchDepth = 2;
+// downloads and unpacked entries take turns over this many file names per
+// source: the ones waiting in a mix's queue, the one being fetched and the
+// one on screen, so none of those is overwritten by the next fetch
+static const int scratchSlots = prefetchDepth + 2;
+
 //----------------------------------------------------------------------------
 
 FileSource::FileSource(QObject *parent) : QObject(parent)
@@ -55,6 +75,22 @@ void FileSource::fetchFile()
     emit nextFile(path_);
 }
 
+void FileSource::cancel()
+{
+
+}
+
+QStringList FileSource::sample(int count)
+{
+    Q_UNUSED(count);
+    return QStringList();
+}
+
+std::function<void()> FileSource::takeSampleJob()
+{
+    return std::function<void()>();
+}
+
 //----------------------------------------------------------------------------
 
 FileListSource::FileListSource(QObject *parent)
@@ -69,7 +105,7 @@ QString FileListSource::shortName()
     return "FileList";
 }
 
-QStringList FileListSource::files()
+PathStore FileListSource::files()
 {
     return files_;
 }
@@ -80,12 +116,13 @@ void FileListSource::processPath()
     if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
         return;
     }
-    files_.clear();
+    QStringList files;
     while (!f.atEnd()) {
         QString line = QString::fromUtf8(f.readLine()).trimmed();
         if (!line.isEmpty())
-            files_.append(line);
+            files.append(line);
     }
+    files_ = PathStore(files);
 }
 
 void FileListSource::fetchFile()
@@ -94,9 +131,24 @@ void FileListSource::fetchFile()
         FileSource::fetchFile();
         return;
     }
-    std::uniform_int_distribution<int> dist(0, files_.size()-1);
+    std::uniform_int_distribution<int> dist(0, files_.count()-1);
     int index = dist(rgen);
-    emit nextFile(files_.value(index));
+    emit nextFile(files_.at(index));
+}
+
+QStringList FileListSource::sample(int count)
+{
+    // a partial shuffle, so no entry comes up twice
+    QVector<int> order(files_.count());
+    std::iota(order.begin(), order.end(), 0);
+    count = std::min(count, order.size());
+    QStringList picked;
+    for (int i = 0; i < count; i++) {
+        std::uniform_int_distribution<int> dist(i, order.size()-1);
+        std::swap(order[i], order[dist(rgen)]);
+        picked.append(files_.at(order[i]));
+    }
+    return picked;
 }
 
 //----------------------------------------------------------------------------
@@ -114,9 +166,10 @@ QString FolderSource::shortName()
 void FolderSource::processPath()
 {
     QDir d(path_);
-    files_.clear();
+    QStringList files;
     for (auto &i : d.entryInfoList({"*.jpg", "*.png"}, QDir::Files))
-        files_.append(i.absoluteFilePath());
+        files.append(i.absoluteFilePath());
+    files_ = PathStore(files);
 }
 
 //----------------------------------------------------------------------------
@@ -137,32 +190,56 @@ void DropSource::processPath()
 
 }
 
-void DropSource::setFiles(const QStringList &files)
+void DropSource::setFiles(const PathStore &files)
 {
-    this->files_ = files;
+    files_ = files;
 }
 
 QVariant DropSource::field()
 {
-    return files_;
+    return files_.toList();
 }
 
 void DropSource::setField(const QVariant &field)
 {
-    files_ = field.toStringList();
+    files_ = PathStore(field.toStringList());
 }
 
 //----------------------------------------------------------------------------
 
-static const char userAgent[] =
+static const char userAgentString[] =
         "Mozilla/5.0 (X11; Linux x86_64)"
         " AppleWebKit/999.99 (KHTML, like Gecko)"
         " Qt314Wall/1.0";
 
 WebSource::WebSource(QObject *parent)
     : FileSource(parent)
+    , scratchSlot(0)
+{
+    mirror_ = new WebMirror(this);
+}
+
+QString WebSource::userAgent()
+{
+    return userAgentString;
+}
+
+QNetworkRequest WebSource::apiRequest(QUrlQuery query) const
 {
+    QUrl url;
+    url.setScheme("https");
+    url.setHost(host);
+    url.setPath(apiPage);
+    query.addQueryItem("tags", tags_.join("+"));
+    url.setQuery(query);
+    QNetworkRequest request(url);
+    request.setHeader(QNetworkRequest::UserAgentHeader, userAgent());
+    return request;
+}
 
+WebMirror *WebSource::mirror()
+{
+    return mirror_;
 }
 
 QString WebSource::shortName()
@@ -222,35 +299,50 @@ void WebSource::setTags(const QStringList &tags)
 
 void WebSource::fetchFile()
 {
-    if (workFolder.isEmpty() || host.isEmpty() || apiPage.isEmpty())
+    // a mirrored query is served from disk
+    QString mirrored = mirror_->isEnabled() ? mirror_->pick() : QString();
+    if (!mirrored.isEmpty()) {
+        cancel();
+        path_ = mirrored;
+        source_ = QUrl::fromLocalFile(mirrored);
+        Metrics::add("mirror/picks");
+        FileSource::fetchFile();
         return;
+    }
 
-    // fetch post info
-    QUrl url("https://nowhere/page.json?a=b");
-    url.setScheme("https");
-    url.setHost(host);
-    url.setPath(apiPage);
+    if (workFolder.isEmpty() || host.isEmpty() || apiPage.isEmpty()) {
+        emit nextFile(QString());
+        return;
+    }
 
+    // fetch post info
     QUrlQuery query;
     query.addQueryItem("limit", "1");
     query.addQueryItem("random", "true");
-    query.addQueryItem("tags", tags_.join("+"));
 
-    url.setQuery(query);
-
-    QNetworkRequest request;
-    request.setHeader(QNetworkRequest::UserAgentHeader, userAgent);
-
-    QNetworkReply *reply = qnam.get(QNetworkRequest(url));
+    cancel();
+    QNetworkReply *reply = qnam.get(apiRequest(query));
     connect(reply, &QNetworkReply::finished,
             this, [reply,this]() { request_json(reply); });
+    pending = reply;
+}
+
+void WebSource::cancel()
+{
+    // abort() finishes the reply, and the handlers throw it away
+    if (pending)
+        pending->abort();
+    pending = nullptr;
 }
 
 void WebSource::request_json(QNetworkReply *jsonReply)
 {
     QUrl imageUrl;
-    QNetworkReply *fileReply;
 
+    if (jsonReply->error() == QNetworkReply::OperationCanceledError) {
+        jsonReply->deleteLater();
+        return;
+    }
     QByteArray response = jsonReply->readAll();
     QJsonDocument json = QJsonDocument::fromJson(response);
     if (json.isNull()) {
@@ -268,15 +360,62 @@ void WebSource::request_json(QNetworkReply *jsonReply)
         imageUrl = fileUrlString;
     }
 
-    fileReply = qnam.get(QNetworkRequest(imageUrl));
-    connect(fileReply, &QNetworkReply::finished,
-            this, [this,fileReply,imageUrl]() { request_file(fileReply, imageUrl); });
+    // look at the thumbnail first: a post the library has a copy of is
+    // shown from there instead of being downloaded again
+    QString previewString = map.value("preview_url",
+                                      map.value("preview_file_url")).toString();
+    if (!previewString.isEmpty() && Catalog::instance()->hasHashes()) {
+        QUrl previewUrl = jsonReply->request().url().resolved(QUrl(previewString));
+        QNetworkReply *previewReply = qnam.get(QNetworkRequest(previewUrl));
+        connect(previewReply, &QNetworkReply::finished,
+                this, [this,previewReply,imageUrl]() {
+            request_preview(previewReply, imageUrl);
+        });
+        pending = previewReply;
+    } else {
+        fetchImage(imageUrl);
+    }
 
     jsonReply->deleteLater();
 }
 
+void WebSource::request_preview(QNetworkReply *previewReply, QUrl imageUrl)
+{
+    if (previewReply->error() == QNetworkReply::OperationCanceledError) {
+        previewReply->deleteLater();
+        return;
+    }
+    QImage preview = QImage::fromData(previewReply->readAll());
+    previewReply->deleteLater();
+    QString local;
+    if (!preview.isNull())
+        local = Catalog::instance()->findNear(Catalog::hashImage(preview));
+    if (local.isEmpty() || !QFileInfo::exists(local)) {
+        fetchImage(imageUrl);
+        return;
+    }
+    pending = nullptr;
+    source_ = imageUrl;
+    path_ = local;
+    Metrics::add("web/localCopies");
+    FileSource::fetchFile();
+}
+
+void WebSource::fetchImage(const QUrl &imageUrl)
+{
+    QNetworkReply *fileReply = qnam.get(QNetworkRequest(imageUrl));
+    connect(fileReply, &QNetworkReply::finished,
+            this, [this,fileReply,imageUrl]() { request_file(fileReply, imageUrl); });
+    pending = fileReply;
+}
+
 void WebSource::request_file(QNetworkReply *fileReply, QUrl url)
 {
+    if (fileReply->error() == QNetworkReply::OperationCanceledError) {
+        fileReply->deleteLater();
+        return;
+    }
+    pending = nullptr;
     source_ = url;
     QString ext = QFileInfo(url.path()).suffix();
     storeTempFile(fileReply->readAll(), ext);
@@ -286,7 +425,9 @@ void WebSource::request_file(QNetworkReply *fileReply, QUrl url)
 
 bool WebSource::storeTempFile(const QByteArray &data, QString ext)
 {
-    path_ = workFolder + "/dl/image." + ext;
+    // named by host, as several web sources in a mix share the folder
+    path_ = QString("%1/dl/%2-%3.%4").arg(workFolder, host).arg(scratchSlot).arg(ext);
+    scratchSlot = (scratchSlot + 1) % scratchSlots;
     QDir(workFolder).mkpath("dl");
     QFile f(path_);
     if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
@@ -295,3 +436,441 @@ bool WebSource::storeTempFile(const QByteArray &data, QString ext)
         return false;
     return true;
 }
+
+//----------------------------------------------------------------------------
+
+// zip record signatures and the fixed part of each record
+static const quint32 zipEndSignature = 0x06054b50;
+static const quint32 zipCentralSignature = 0x02014b50;
+static const quint32 zipLocalSignature = 0x04034b50;
+static const int zipEndBytes = 22;
+static const int zipCentralBytes = 46;
+static const int zipLocalBytes = 30;
+static const int zipMaxComment = 0xffff;
+static const quint16 zipStored = 0;
+static const quint16 zipDeflated = 8;
+static const quint16 zipEncrypted = 1;
+static const int inflateChunk = 65536;
+
+static quint16 le16(const char *p)
+{
+    const uchar *u = reinterpret_cast<const uchar*>(p);
+    return quint16(u[0] | u[1] << 8);
+}
+
+static quint32 le32(const char *p)
+{
+    return le16(p) | quint32(le16(p + 2)) << 16;
+}
+
+ArchiveSource::ArchiveSource(QObject *parent)
+    : FileSource(parent)
+    , scratchSlot(0)
+    , fetchGeneration(0)
+    , rgen(rseed())
+{
+
+}
+
+QString ArchiveSource::shortName()
+{
+    return "Archive";
+}
+
+void ArchiveSource::setWorkFolder(const QString &folder)
+{
+    workFolder = folder;
+}
+
+void ArchiveSource::processPath()
+{
+    static const QStringList validExtensions({ "jpg", "jpeg", "jpe", "png",
+                                               "bmp", "dib", "gif" });
+    entries.clear();
+    names.clear();
+    QFile f(path_);
+    if (!f.open(QIODevice::ReadOnly))
+        return;
+
+    // the end record is last, followed by a comment of up to 64k
+    qint64 tailBytes = std::min<qint64>(f.size(), zipEndBytes + zipMaxComment);
+    if (tailBytes < zipEndBytes || !f.seek(f.size() - tailBytes))
+        return;
+    QByteArray tail = f.read(tailBytes);
+    int end = tail.size() - zipEndBytes;
+    while (end >= 0 && le32(tail.constData() + end) != zipEndSignature)
+        end--;
+    if (end < 0)
+        return;
+    const char *e = tail.constData() + end;
+    quint32 dirBytes = le32(e + 12);
+    quint32 dirOffset = le32(e + 16);
+    // zip64 archives (over 4GB or 65535 entries) are not read
+    if (le16(e + 10) == 0xffff || dirOffset == 0xffffffff)
+        return;
+    if (!f.seek(dirOffset))
+        return;
+    QByteArray dir = f.read(dirBytes);
+
+    entries.reserve(le16(e + 10));
+    int pos = 0;
+    while (pos + zipCentralBytes <= dir.size()) {
+        const char *c = dir.constData() + pos;
+        if (le32(c) != zipCentralSignature)
+            break;
+        quint16 flags = le16(c + 8);
+        quint16 method = le16(c + 10);
+        quint16 nameLength = le16(c + 28);
+        int next = pos + zipCentralBytes + nameLength + le16(c + 30) + le16(c + 32);
+        if (pos + zipCentralBytes + nameLength > dir.size())
+            break;
+        QByteArray name(c + zipCentralBytes, nameLength);
+        QString suffix = QFileInfo(QString::fromUtf8(name)).suffix().toLower();
+        if (!(flags & zipEncrypted) && (method == zipStored || method == zipDeflated)
+                && validExtensions.contains(suffix)) {
+            entries.append(Entry { le32(c + 42), le32(c + 20), le32(c + 24),
+                                   le32(c + 16), quint32(names.size()),
+                                   nameLength, method });
+            names.append(name);
+        }
+        pos = next;
+    }
+    entries.squeeze();
+    names.squeeze();
+}
+
+bool ArchiveSource::inflateEntry(const QString &archive, const Entry &entry,
+                                 const QString &fileName)
+{
+    QFile in(archive);
+    if (!in.open(QIODevice::ReadOnly) || !in.seek(entry.offset))
+        return false;
+    // the local header's name and extra field can differ in length from
+    // the central directory's
+    QByteArray local = in.read(zipLocalBytes);
+    if (local.size() < zipLocalBytes || le32(local.constData()) != zipLocalSignature)
+        return false;
+    if (!in.seek(qint64(entry.offset) + zipLocalBytes
+                 + le16(local.constData() + 26) + le16(local.constData() + 28)))
+        return false;
+    QFile out(fileName);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (entry.method == zipDeflated && inflateInit2(&z, -MAX_WBITS) != Z_OK)
+        return false;
+    QByteArray inBuf(inflateChunk, Qt::Uninitialized);
+    QByteArray outBuf(inflateChunk, Qt::Uninitialized);
+    uLong crc = crc32(0, nullptr, 0);
+    qint64 left = entry.packed;
+    int status = Z_OK;
+    while (left > 0 && status == Z_OK) {
+        qint64 got = in.read(inBuf.data(), std::min<qint64>(left, inflateChunk));
+        if (got <= 0)
+            break;
+        left -= got;
+        if (entry.method == zipStored) {
+            crc = crc32(crc, reinterpret_cast<const Bytef*>(inBuf.constData()), uInt(got));
+            out.write(inBuf.constData(), got);
+            continue;
+        }
+        z.next_in = reinterpret_cast<Bytef*>(inBuf.data());
+        z.avail_in = uInt(got);
+        do {
+            z.next_out = reinterpret_cast<Bytef*>(outBuf.data());
+            z.avail_out = inflateChunk;
+            status = inflate(&z, Z_NO_FLUSH);
+            // no progress: the last output exactly filled the chunk, and
+            // the rest needs more input
+            if (status == Z_BUF_ERROR && z.avail_in == 0) {
+                status = Z_OK;
+                break;
+            }
+            if (status != Z_OK && status != Z_STREAM_END)
+                break;
+            uInt made = inflateChunk - z.avail_out;
+            crc = crc32(crc, reinterpret_cast<const Bytef*>(outBuf.constData()), made);
+            out.write(outBuf.constData(), made);
+        } while (z.avail_out == 0 && status == Z_OK);
+    }
+    if (entry.method == zipDeflated)
+        inflateEnd(&z);
+    bool complete = entry.method == zipStored ? left == 0 : status == Z_STREAM_END;
+    return complete && crc == entry.crc && out.size() == entry.size;
+}
+
+ArchiveSource::Unpack ArchiveSource::unpackTo(const Entry &entry,
+                                              const QString &baseName)
+{
+    QString name = QString::fromUtf8(names.constData() + entry.name,
+                                     entry.nameLength);
+    QDir(workFolder).mkpath("arc");
+    return Unpack { entry, QString("%1/arc/%2.%3").arg(workFolder, baseName,
+                                        QFileInfo(name).suffix().toLower()) };
+}
+
+bool ArchiveSource::unpack(const QString &archive, const Unpack &job)
+{
+    if (inflateEntry(archive, job.entry, job.fileName))
+        return true;
+    QFile::remove(job.fileName);
+    return false;
+}
+
+void ArchiveSource::fetchFile()
+{
+    if (entries.isEmpty() || workFolder.isEmpty()) {
+        emit nextFile(QString());
+        return;
+    }
+    std::uniform_int_distribution<int> dist(0, entries.size()-1);
+    QString baseName = QString("image-%1").arg(scratchSlot);
+    scratchSlot = (scratchSlot + 1) % scratchSlots;
+    Unpack job = unpackTo(entries[dist(rgen)], baseName);
+    QString archive = path_;
+    int generation = ++fetchGeneration;
+    auto watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished,
+            this, [this, watcher, job, generation]() {
+        watcher->deleteLater();
+        if (generation != fetchGeneration)
+            return;
+        emit nextFile(watcher->result() ? job.fileName : QString());
+    });
+    // large entries take long enough to inflate to be felt in the GUI
+    watcher->setFuture(QtConcurrent::run([archive, job]() {
+        return unpack(archive, job);
+    }));
+}
+
+void ArchiveSource::cancel()
+{
+    fetchGeneration++;
+}
+
+QStringList ArchiveSource::sample(int count)
+{
+    if (workFolder.isEmpty())
+        return QStringList();
+    QVector<int> order(entries.size());
+    std::iota(order.begin(), order.end(), 0);
+    count = std::min(count, order.size());
+    QStringList picked;
+    QList<Unpack> jobs;
+    for (int i = 0; i < count; i++) {
+        std::uniform_int_distribution<int> dist(i, order.size()-1);
+        std::swap(order[i], order[dist(rgen)]);
+        jobs.append(unpackTo(entries[order[i]], QString("sample-%1").arg(i)));
+        picked.append(jobs.last().fileName);
+    }
+    // unpacked once by whoever renders the mosaic; entries that fail to
+    // are left out of it
+    QString archive = path_;
+    QSharedPointer<QAtomicInt> done(new QAtomicInt(0));
+    sampleJob = [archive, jobs, done]() mutable {
+        if (!done->testAndSetOrdered(0, 1))
+            return;
+        QtConcurrent::blockingMap(jobs, [archive](Unpack &job) {
+            unpack(archive, job);
+        });
+    };
+    return picked;
+}
+
+std::function<void()> ArchiveSource::takeSampleJob()
+{
+    std::function<void()> job = sampleJob;
+    sampleJob = std::function<void()>();
+    return job;
+}
+
+//----------------------------------------------------------------------------
+
+MixSource::MixSource(QObject *parent)
+    : FileSource(parent)
+    , waiting(false)
+    , filling(false)
+    , lastPick(-1)
+    , rgen(rseed())
+{
+
+}
+
+QString MixSource::shortName()
+{
+    return "Mix";
+}
+
+QUrl MixSource::source()
+{
+    if (lastPick < 0 || lastPick >= feeds.count())
+        return QUrl();
+    return feeds[lastPick].source->source();
+}
+
+void MixSource::setSources(const QList<FileSource *> &sources,
+                           const QList<int> &weights)
+{
+    for (const QMetaObject::Connection &c : connections)
+        disconnect(c);
+    connections.clear();
+    for (const Feed &feed : feeds)
+        if (feed.fetching)
+            feed.source->cancel();
+    feeds.clear();
+    waiting = false;
+    lastPick = -1;
+
+    for (int i = 0; i < sources.count(); i++) {
+        feeds.append(Feed { sources[i], weights.value(i), QStringList(),
+                            false, false });
+        connections.append(connect(sources[i], &FileSource::nextFile,
+                                   this, [this,i](QString fileName) {
+            source_nextFile(i, fileName);
+        }));
+    }
+}
+
+QList<FileSource *> MixSource::sources()
+{
+    QList<FileSource*> list;
+    for (const Feed &feed : feeds)
+        list.append(feed.source);
+    return list;
+}
+
+void MixSource::fetchFile()
+{
+    if (feeds.isEmpty()) {
+        emit nextFile(QString());
+        return;
+    }
+    waiting = true;
+    // sources that came up empty get another chance with every request
+    for (Feed &feed : feeds)
+        feed.failed = false;
+    fill();
+}
+
+void MixSource::cancel()
+{
+    // the queues keep filling; only the request is dropped
+    waiting = false;
+}
+
+QStringList MixSource::sample(int count)
+{
+    int total = 0;
+    for (const Feed &feed : feeds)
+        total += feed.weight;
+    QStringList picked;
+    for (const Feed &feed : feeds)
+        if (total > 0)
+            picked.append(feed.source->sample((count * feed.weight + total/2) / total));
+    std::shuffle(picked.begin(), picked.end(), rgen);
+    return picked.mid(0, count);
+}
+
+std::function<void()> MixSource::takeSampleJob()
+{
+    QList<std::function<void()>> jobs;
+    for (const Feed &feed : feeds) {
+        std::function<void()> job = feed.source->takeSampleJob();
+        if (job)
+            jobs.append(job);
+    }
+    if (jobs.isEmpty())
+        return std::function<void()>();
+    return [jobs]() {
+        for (const std::function<void()> &job : jobs)
+            job();
+    };
+}
+
+void MixSource::source_nextFile(int index, const QString &fileName)
+{
+    Feed &feed = feeds[index];
+    if (!feed.fetching)
+        return;
+    feed.fetching = false;
+    if (fileName.isEmpty())
+        feed.failed = true;
+    else
+        feed.queue.append(fileName);
+    if (waiting)
+        pick();
+    fill();
+}
+
+void MixSource::pick()
+{
+    // by weight among the sources with something ready, so the pick is as
+    // quick as the quickest of them
+    int total = 0;
+    for (const Feed &feed : feeds)
+        if (!feed.queue.isEmpty())
+            total += feed.weight;
+    if (total <= 0) {
+        bool pending = false;
+        for (const Feed &feed : feeds)
+            pending = pending || feed.fetching;
+        if (!pending && !filling) {
+            // nothing ready and nothing coming
+            waiting = false;
+            emit nextFile(QString());
+        }
+        return;
+    }
+    std::uniform_int_distribution<int> dist(0, total - 1);
+    int ticket = dist(rgen);
+    int i = 0;
+    for (; i < feeds.count(); i++) {
+        if (feeds[i].queue.isEmpty())
+            continue;
+        if (ticket < feeds[i].weight)
+            break;
+        ticket -= feeds[i].weight;
+    }
+    lastPick = i;
+    waiting = false;
+    QString fileName = feeds[i].queue.takeFirst();
+    Metrics::add(QString("mix/%1/picks").arg(feeds[i].source->shortName()));
+    updateMetrics();
+    emit nextFile(fileName);
+    fill();
+}
+
+void MixSource::fill()
+{
+    // local sources answer while being asked, so this goes round until
+    // every source is either full or busy fetching
+    if (filling)
+        return;
+    filling = true;
+    bool started;
+    do {
+        started = false;
+        for (int i = 0; i < feeds.count(); i++) {
+            Feed &feed = feeds[i];
+            if (feed.fetching || feed.failed || feed.weight <= 0
+                    || feed.queue.count() >= prefetchDepth)
+                continue;
+            feed.fetching = true;
+            started = true;
+            feed.source->fetchFile();
+        }
+    } while (started);
+    filling = false;
+    updateMetrics();
+    if (waiting)
+        pick();
+}
+
+void MixSource::updateMetrics()
+{
+    for (const Feed &feed : feeds)
+        Metrics::set(QString("mix/%1/queued").arg(feed.source->shortName()),
+                     feed.queue.count());
+}
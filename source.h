@@ -2,13 +2,22 @@
 #define SOURCE_H
 
 #include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QPointer>
 #include <QUrl>
+#include <QUrlQuery>
 #include <QObject>
 #include <QVariantMap>
+#include <QVector>
+#include <functional>
 #include <random>
+#include "pathstore.h"
 
 namespace Sources {
 
+class WebMirror;
+
 //----------------------------------------------------------------------------
 
 class FileSource : public QObject
@@ -22,6 +31,11 @@ public:
     virtual void processPath();
     virtual QVariant field();
     virtual void setField(const QVariant &field);
+    // Up to count more files picked at random, without fetching anything.
+    virtual QStringList sample(int count);
+    // Work the last sample() left for a worker thread: the files it named
+    // are only all there once this has run.  Empty when there is none.
+    virtual std::function<void()> takeSampleJob();
 
 signals:
     void nextFile(QString fileName);
@@ -29,6 +43,8 @@ signals:
 public slots:
     void setPath(const QString &filePath);
     virtual void fetchFile();
+    // Drop a fetch still in progress; it will not emit nextFile.
+    virtual void cancel();
 
 protected:
     QString path_;
@@ -42,14 +58,15 @@ class FileListSource : public FileSource
 public:
     explicit FileListSource(QObject *parent = nullptr);
     QString shortName();
-    QStringList files();
+    PathStore files();
     void processPath();
+    QStringList sample(int count);
 
 public slots:
     void fetchFile();
 
 protected:
-    QStringList files_;
+    PathStore files_;
     std::random_device rseed;
     std::mt19937 rgen;
 };
@@ -74,7 +91,7 @@ public:
     explicit DropSource(QObject *parent = nullptr);
     QString shortName();
     void processPath();
-    void setFiles(const QStringList &files_);
+    void setFiles(const PathStore &files);
     QVariant field();
     void setField(const QVariant &field);
 };
@@ -92,6 +109,10 @@ public:
     QStringList tags();
     QVariant field();
     void setField(const QVariant &field);
+    // The post query with the tags added.
+    QNetworkRequest apiRequest(QUrlQuery query) const;
+    WebMirror *mirror();
+    static QString userAgent();
 
 signals:
     void nextFile(QString fileName);
@@ -103,12 +124,15 @@ public slots:
     void setApiPage(const QString &uri);
     void setTags(const QStringList &tags);
     void fetchFile();
+    void cancel();
 
 private slots:
     void request_json(QNetworkReply *jsonReply);
+    void request_preview(QNetworkReply *previewReply, QUrl imageUrl);
     void request_file(QNetworkReply *fileReply, QUrl url);
 
 protected:
+    void fetchImage(const QUrl &imageUrl);
     bool storeTempFile(const QByteArray &data, QString ext);
 
     QNetworkAccessManager qnam;
@@ -118,6 +142,109 @@ protected:
     QString apiPage;
     QUrl source_;
     QStringList tags_;
+    QPointer<QNetworkReply> pending;
+    int scratchSlot;
+    WebMirror *mirror_;
+};
+
+//----------------------------------------------------------------------------
+
+// Images inside a zip or cbz.  The central directory is read once into a
+// small index of the image entries, and each pick inflates just that one
+// entry into the work folder, so the archive is never unpacked.
+class ArchiveSource : public FileSource
+{
+    Q_OBJECT
+public:
+    explicit ArchiveSource(QObject *parent = nullptr);
+    QString shortName();
+    void processPath();
+    // Names the entries picked; they are unpacked by takeSampleJob().
+    QStringList sample(int count);
+    std::function<void()> takeSampleJob();
+
+public slots:
+    void setWorkFolder(const QString &folder);
+    // Unpacks an entry on the global thread pool.
+    void fetchFile();
+    void cancel();
+
+private:
+    struct Entry {
+        quint32 offset;     // of the local header
+        quint32 packed;
+        quint32 size;
+        quint32 crc;
+        quint32 name;       // into names
+        quint16 nameLength;
+        quint16 method;
+    };
+    // an entry and the file it goes to, all a worker thread needs
+    struct Unpack {
+        Entry entry;
+        QString fileName;
+    };
+
+    Unpack unpackTo(const Entry &entry, const QString &baseName);
+    static bool unpack(const QString &archive, const Unpack &job);
+    static bool inflateEntry(const QString &archive, const Entry &entry,
+                             const QString &fileName);
+
+    QVector<Entry> entries;
+    QByteArray names;
+    QString workFolder;
+    int scratchSlot;
+    int fetchGeneration;    // bumped to drop the fetch in progress
+    std::function<void()> sampleJob;
+    std::random_device rseed;
+    std::mt19937 rgen;
+};
+
+//----------------------------------------------------------------------------
+
+// Several sources at once, picked from by weight.  Each source keeps a short
+// queue of files fetched ahead, all filling at the same time, so a pick
+// takes as long as the quickest source with something ready and a slow
+// download never holds up the local sources.
+class MixSource : public FileSource
+{
+    Q_OBJECT
+public:
+    explicit MixSource(QObject *parent = nullptr);
+    QString shortName();
+    // Where the last pick came from.
+    QUrl source();
+    QStringList sample(int count);
+    std::function<void()> takeSampleJob();
+    // Replaces the mix, dropping what was queued; none stops all fetching.
+    void setSources(const QList<FileSource*> &sources, const QList<int> &weights);
+    QList<FileSource*> sources();
+
+public slots:
+    void fetchFile();
+    void cancel();
+
+private:
+    struct Feed {
+        FileSource *source;
+        int weight;
+        QStringList queue;
+        bool fetching;
+        bool failed;        // came up empty, left alone until asked again
+    };
+
+    void source_nextFile(int index, const QString &fileName);
+    void pick();
+    void fill();
+    void updateMetrics();
+
+    QVector<Feed> feeds;
+    QList<QMetaObject::Connection> connections;
+    bool waiting;
+    bool filling;
+    int lastPick;
+    std::random_device rseed;
+    std::mt19937 rgen;
 };
 
 //----------------------------------------------------------------------------
@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# PowerWatch against stub screensaver and UPower services; run under
+# tests/run-tests.sh, which gives it a private bus
+#
+#-------------------------------------------------
+
+QT       += core dbus testlib
+QT       -= gui
+
+TARGET = tst_powerwatch
+TEMPLATE = app
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_powerwatch.cpp \
+    ../../powerwatch.cpp
+
+HEADERS  += ../../powerwatch.h
@@ -0,0 +1,213 @@
+#include <QtTest>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QThread>
+#include <limits>
+#include "powerwatch.h"
+
+// PowerWatch against stand-ins for the screensaver and UPower, on the
+// private bus tests/run-tests.sh starts (the system bus address points
+// there too).  The stubs answer from a thread of their own, as PowerWatch
+// calls them synchronously.
+
+static const char screenSaverService[] = "org.freedesktop.ScreenSaver";
+static const char screenSaverPath[] = "/org/freedesktop/ScreenSaver";
+static const char screenSaverInterface[] = "org.freedesktop.ScreenSaver";
+static const char upowerService[] = "org.freedesktop.UPower";
+static const char upowerPath[] = "/org/freedesktop/UPower";
+static const char upowerInterface[] = "org.freedesktop.UPower";
+static const char propertiesInterface[] = "org.freedesktop.DBus.Properties";
+static const char sessionStubs[] = "stub-session";
+static const char systemStubs[] = "stub-system";
+static const int signalTimeout = 5000;
+
+class ScreenSaverStub : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.freedesktop.ScreenSaver")
+public:
+    QAtomicInt active;
+
+public slots:
+    bool GetActive() { return active.load(); }
+};
+
+class UPowerStub : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.freedesktop.UPower")
+    Q_PROPERTY(bool OnBattery READ onBattery)
+public:
+    QAtomicInt battery;
+    bool onBattery() const { return battery.load(); }
+};
+
+class TestPowerWatch : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void startsFromCurrentState();
+    void lockPausesAndPreparesFrame();
+    void unlockShowsPreparedFrame();
+    void batteryStretchesInterval();
+    void invalidatedPropertyIsFetched();
+    void intervalIsClamped();
+
+private:
+    void setLocked(bool locked);
+    void setBattery(bool battery, bool invalidate = false);
+
+    QThread stubThread;
+    ScreenSaverStub *saver;
+    UPowerStub *upower;
+};
+
+void TestPowerWatch::initTestCase()
+{
+    if (qEnvironmentVariableIsEmpty("QT314WALL_TEST_BUS"))
+        QSKIP("needs a private bus, run through tests/run-tests.sh");
+    saver = new ScreenSaverStub;
+    upower = new UPowerStub;
+    saver->moveToThread(&stubThread);
+    upower->moveToThread(&stubThread);
+    stubThread.start();
+
+    QDBusConnection session = QDBusConnection::connectToBus(
+                QDBusConnection::SessionBus, sessionStubs);
+    QDBusConnection system = QDBusConnection::connectToBus(
+                QDBusConnection::SystemBus, systemStubs);
+    QVERIFY(session.isConnected() && system.isConnected());
+    QVERIFY(session.registerObject(screenSaverPath, saver,
+                                   QDBusConnection::ExportAllSlots));
+    QVERIFY(session.registerService(screenSaverService));
+    QVERIFY(system.registerObject(upowerPath, upower,
+                                  QDBusConnection::ExportAllProperties));
+    QVERIFY(system.registerService(upowerService));
+}
+
+void TestPowerWatch::cleanupTestCase()
+{
+    if (!stubThread.isRunning())
+        return;
+    QDBusConnection::disconnectFromBus(sessionStubs);
+    QDBusConnection::disconnectFromBus(systemStubs);
+    stubThread.quit();
+    stubThread.wait();
+    delete saver;
+    delete upower;
+}
+
+void TestPowerWatch::setLocked(bool locked)
+{
+    saver->active.store(locked);
+    QDBusMessage m = QDBusMessage::createSignal(screenSaverPath,
+                                                screenSaverInterface,
+                                                "ActiveChanged");
+    m << locked;
+    QVERIFY(QDBusConnection(sessionStubs).send(m));
+}
+
+void TestPowerWatch::setBattery(bool battery, bool invalidate)
+{
+    upower->battery.store(battery);
+    QVariantMap changed;
+    QStringList invalidated;
+    if (invalidate)
+        invalidated << "OnBattery";
+    else
+        changed.insert("OnBattery", battery);
+    QDBusMessage m = QDBusMessage::createSignal(upowerPath, propertiesInterface,
+                                                "PropertiesChanged");
+    m << QString(upowerInterface) << changed << invalidated;
+    QVERIFY(QDBusConnection(systemStubs).send(m));
+}
+
+void TestPowerWatch::startsFromCurrentState()
+{
+    saver->active.store(true);
+    upower->battery.store(true);
+    PowerWatch watch;
+    QVERIFY(watch.screenLocked());
+    QVERIFY(watch.onBattery());
+    saver->active.store(false);
+    upower->battery.store(false);
+    PowerWatch idle;
+    QVERIFY(!idle.screenLocked());
+    QVERIFY(!idle.onBattery());
+}
+
+void TestPowerWatch::lockPausesAndPreparesFrame()
+{
+    saver->active.store(false);
+    PowerWatch watch;
+    QSignalSpy spy(&watch, &PowerWatch::changed);
+    setLocked(true);
+    QVERIFY(spy.wait(signalTimeout));
+    // Flow stops the schedule while locked and renders one for the unlock
+    QVERIFY(watch.screenLocked());
+    QCOMPARE(PowerWatch::unlockStep(watch.screenLocked(), false),
+             PowerWatch::PrepareFrame);
+    // and only one: a frame in hand is not replaced
+    QCOMPARE(PowerWatch::unlockStep(watch.screenLocked(), true),
+             PowerWatch::NothingToDo);
+    setLocked(false);
+    QVERIFY(spy.wait(signalTimeout));
+}
+
+void TestPowerWatch::unlockShowsPreparedFrame()
+{
+    saver->active.store(true);
+    PowerWatch watch;
+    QVERIFY(watch.screenLocked());
+    QSignalSpy spy(&watch, &PowerWatch::changed);
+    setLocked(false);
+    QVERIFY(spy.wait(signalTimeout));
+    QVERIFY(!watch.screenLocked());
+    QCOMPARE(PowerWatch::unlockStep(watch.screenLocked(), true),
+             PowerWatch::ShowFrame);
+    QCOMPARE(PowerWatch::unlockStep(watch.screenLocked(), false),
+             PowerWatch::NothingToDo);
+}
+
+void TestPowerWatch::batteryStretchesInterval()
+{
+    upower->battery.store(false);
+    PowerWatch watch;
+    QCOMPARE(watch.interval(60000), 60000);
+    QSignalSpy spy(&watch, &PowerWatch::changed);
+    setBattery(true);
+    QVERIFY(spy.wait(signalTimeout));
+    QVERIFY(watch.onBattery());
+    QCOMPARE(watch.interval(60000), 240000);
+    setBattery(false);
+    QVERIFY(spy.wait(signalTimeout));
+    QCOMPARE(watch.interval(60000), 60000);
+}
+
+void TestPowerWatch::invalidatedPropertyIsFetched()
+{
+    upower->battery.store(false);
+    PowerWatch watch;
+    QSignalSpy spy(&watch, &PowerWatch::changed);
+    setBattery(true, true);
+    QVERIFY(spy.wait(signalTimeout));
+    QVERIFY(watch.onBattery());
+}
+
+void TestPowerWatch::intervalIsClamped()
+{
+    upower->battery.store(true);
+    PowerWatch watch;
+    QVERIFY(watch.onBattery());
+    // the dialog goes up to a year, past what an int holds even before
+    // stretching
+    QCOMPARE(watch.interval(qint64(8760) * 3600000),
+             std::numeric_limits<int>::max());
+    QCOMPARE(watch.interval(qint64(168) * 3600000),
+             std::numeric_limits<int>::max());
+}
+
+QTEST_GUILESS_MAIN(TestPowerWatch)
+#include "tst_powerwatch.moc"
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Runs the tests built in $1 (default: the current folder), each with the
+# private servers it needs: dbus-run-session (dbus) for powerwatch, and
+# xvfb-run (Xvfb) for x11publisher, with and without MIT-SHM.
+build=${1:-.}
+status=0
+
+# one private bus stands in for both the session and the system bus
+dbus-run-session -- sh -c \
+    'DBUS_SYSTEM_BUS_ADDRESS=$DBUS_SESSION_BUS_ADDRESS QT314WALL_TEST_BUS=1 \
+     exec "$0"' "$build/powerwatch/tst_powerwatch" || status=1
+
+for shm in "" "-extension MIT-SHM"; do
+    QT314WALL_TEST_DISPLAY=1 xvfb-run -a -s "-screen 0 800x600x24 $shm" \
+        "$build/x11publisher/tst_x11publisher" || status=1
+done
+
+exit $status
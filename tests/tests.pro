@@ -0,0 +1,8 @@
+#-------------------------------------------------
+#
+# Tests, built and run from the top level with `make check`
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+SUBDIRS = powerwatch x11publisher
@@ -0,0 +1,171 @@
+#include <QtTest>
+#include <QImage>
+#include "x11publisher.h"
+
+#ifdef HAVE_XCB
+#include <cstdlib>
+#include <cstring>
+#include <xcb/xcb.h>
+#endif
+
+// X11Publisher against the private Xvfb tests/run-tests.sh starts, once
+// with MIT-SHM and once without.  Each frame is read back from the pixmap
+// the root window properties point at.
+
+static const QSize frameSize(640, 480);
+
+#ifdef HAVE_XCB
+// The root window's pixmap as published in property, XCB_NONE if unset.
+static xcb_pixmap_t rootPixmap(xcb_connection_t *c, xcb_window_t root,
+                               const char *property)
+{
+    xcb_intern_atom_reply_t *atom = xcb_intern_atom_reply(c,
+            xcb_intern_atom(c, 1, uint16_t(strlen(property)), property),
+            nullptr);
+    if (!atom)
+        return XCB_NONE;
+    xcb_get_property_reply_t *reply = xcb_get_property_reply(c,
+            xcb_get_property(c, 0, root, atom->atom, XCB_ATOM_PIXMAP, 0, 1),
+            nullptr);
+    free(atom);
+    xcb_pixmap_t pixmap = XCB_NONE;
+    if (reply && reply->type == XCB_ATOM_PIXMAP
+            && xcb_get_property_value_length(reply) == 4)
+        pixmap = *static_cast<xcb_pixmap_t*>(xcb_get_property_value(reply));
+    free(reply);
+    return pixmap;
+}
+
+// The pixmap's contents as RGB32, null if it is gone.
+static QImage readPixmap(xcb_connection_t *c, xcb_pixmap_t pixmap,
+                         const QSize &size)
+{
+    xcb_get_image_reply_t *reply = xcb_get_image_reply(c,
+            xcb_get_image(c, XCB_IMAGE_FORMAT_Z_PIXMAP, pixmap, 0, 0,
+                          uint16_t(size.width()), uint16_t(size.height()),
+                          ~0u),
+            nullptr);
+    if (!reply)
+        return QImage();
+    QImage image(size, QImage::Format_RGB32);
+    int length = xcb_get_image_data_length(reply);
+    if (length == image.bytesPerLine() * size.height())
+        memcpy(image.bits(), xcb_get_image_data(reply), size_t(length));
+    else
+        image = QImage();
+    free(reply);
+    return image;
+}
+#endif
+
+// A frame no two pixels of which agree by accident.
+static QImage testFrame(int seed)
+{
+    QImage frame(frameSize, QImage::Format_RGB32);
+    for (int y = 0; y < frame.height(); y++) {
+        QRgb *line = reinterpret_cast<QRgb*>(frame.scanLine(y));
+        for (int x = 0; x < frame.width(); x++)
+            line[x] = qRgb((x + seed) & 0xff, (y * 3 + seed) & 0xff,
+                           (x ^ y) & 0xff);
+    }
+    return frame;
+}
+
+static bool sameColours(const QImage &a, const QImage &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (int y = 0; y < a.height(); y++) {
+        const QRgb *la = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+        const QRgb *lb = reinterpret_cast<const QRgb*>(b.constScanLine(y));
+        for (int x = 0; x < a.width(); x++)
+            if ((la[x] ^ lb[x]) & 0xffffff)
+                return false;
+    }
+    return true;
+}
+
+class TestX11Publisher : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void publishesFrame();
+    void replacesPreviousPixmap();
+    void convertsOtherFormats();
+
+#ifdef HAVE_XCB
+private:
+    void check(const QImage &expected, xcb_pixmap_t *published = nullptr);
+#endif
+};
+
+void TestX11Publisher::initTestCase()
+{
+#ifndef HAVE_XCB
+    QSKIP("built without xcb and xcb-shm");
+#endif
+    if (qEnvironmentVariableIsEmpty("QT314WALL_TEST_DISPLAY"))
+        QSKIP("needs a private X server, run through tests/run-tests.sh");
+    QVERIFY(X11Publisher::isAvailable());
+}
+
+#ifdef HAVE_XCB
+void TestX11Publisher::check(const QImage &expected, xcb_pixmap_t *published)
+{
+    int screenNumber = 0;
+    xcb_connection_t *c = xcb_connect(nullptr, &screenNumber);
+    QVERIFY(!xcb_connection_has_error(c));
+    xcb_window_t root = xcb_setup_roots_iterator(xcb_get_setup(c)).data->root;
+    xcb_pixmap_t pixmap = rootPixmap(c, root, "_XROOTPMAP_ID");
+    xcb_pixmap_t esetroot = rootPixmap(c, root, "ESETROOT_PMAP_ID");
+    QImage actual = readPixmap(c, pixmap, expected.size());
+    xcb_disconnect(c);
+    QVERIFY(pixmap != XCB_NONE);
+    QCOMPARE(esetroot, pixmap);
+    QVERIFY(!actual.isNull());
+    QVERIFY(sameColours(actual, expected));
+    if (published)
+        *published = pixmap;
+}
+#endif
+
+void TestX11Publisher::publishesFrame()
+{
+#ifdef HAVE_XCB
+    QImage frame = testFrame(0);
+    QVERIFY(X11Publisher::publish(frame));
+    check(frame);
+#endif
+}
+
+void TestX11Publisher::replacesPreviousPixmap()
+{
+#ifdef HAVE_XCB
+    xcb_pixmap_t first = XCB_NONE, second = XCB_NONE;
+    QVERIFY(X11Publisher::publish(testFrame(1)));
+    check(testFrame(1), &first);
+    QVERIFY(X11Publisher::publish(testFrame(2)));
+    check(testFrame(2), &second);
+    QVERIFY(first != second);
+    // the old pixmap is freed rather than leaked in the server
+    int screenNumber = 0;
+    xcb_connection_t *c = xcb_connect(nullptr, &screenNumber);
+    QVERIFY(!xcb_connection_has_error(c));
+    QImage gone = readPixmap(c, first, frameSize);
+    xcb_disconnect(c);
+    QVERIFY(gone.isNull());
+#endif
+}
+
+void TestX11Publisher::convertsOtherFormats()
+{
+#ifdef HAVE_XCB
+    QImage frame = testFrame(3);
+    QVERIFY(X11Publisher::publish(frame.convertToFormat(QImage::Format_RGB888)));
+    check(frame);
+#endif
+}
+
+QTEST_GUILESS_MAIN(TestX11Publisher)
+#include "tst_x11publisher.moc"
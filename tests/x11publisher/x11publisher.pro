@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# X11Publisher against a private Xvfb; run under tests/run-tests.sh
+#
+#-------------------------------------------------
+
+QT       += core gui testlib
+
+TARGET = tst_x11publisher
+TEMPLATE = app
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_x11publisher.cpp \
+    ../../x11publisher.cpp
+
+HEADERS  += ../../x11publisher.h
+
+packagesExist(xcb xcb-shm) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += xcb xcb-shm
+    DEFINES += HAVE_XCB
+}
@@ -0,0 +1,120 @@
+#include "thumbnailer.h"
+#include "metrics.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <QUrl>
+#include <QtConcurrent>
+#include <algorithm>
+
+// the spec's "normal" size
+static const int thumbnailSide = 128;
+// requests kept waiting; older ones have scrolled out of view
+static const int maxPending = 256;
+
+Thumbnailer::Thumbnailer(QObject *parent) : QObject(parent), running(0)
+{
+    pool.setMaxThreadCount(std::max(2, QThread::idealThreadCount() / 2));
+}
+
+Thumbnailer::~Thumbnailer()
+{
+    clear();
+    pool.waitForDone();
+}
+
+void Thumbnailer::request(const QString &fileName)
+{
+    if (queued.contains(fileName))
+        pending.removeOne(fileName);
+    pending.append(fileName);
+    queued.insert(fileName);
+    while (pending.count() > maxPending)
+        queued.remove(pending.takeFirst());
+    startJobs();
+}
+
+void Thumbnailer::clear()
+{
+    for (const QString &fileName : pending)
+        queued.remove(fileName);
+    pending.clear();
+}
+
+void Thumbnailer::startJobs()
+{
+    // only as many jobs as threads, so the newest request is picked when
+    // a thread comes free rather than when it was asked for
+    while (running < pool.maxThreadCount() && !pending.isEmpty()) {
+        QString fileName = pending.takeLast();
+        running++;
+        QtConcurrent::run(&pool, [this,fileName]() {
+            QImage image = thumbnail(fileName);
+            QMetaObject::invokeMethod(this, [this,fileName,image]() {
+                running--;
+                queued.remove(fileName);
+                emit ready(fileName, image);
+                startJobs();
+            }, Qt::QueuedConnection);
+        });
+    }
+}
+
+QString Thumbnailer::cachePath(const QString &uri)
+{
+    return QString("%1/thumbnails/normal/%2.png")
+            .arg(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation),
+                 QString(QCryptographicHash::hash(uri.toUtf8(),
+                                                  QCryptographicHash::Md5).toHex()));
+}
+
+QImage Thumbnailer::thumbnail(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    QString uri = QString::fromUtf8(QUrl::fromLocalFile(info.absoluteFilePath()).toEncoded());
+    QString mtime = QString::number(info.lastModified().toMSecsSinceEpoch() / 1000);
+    QString path = cachePath(uri);
+
+    // the text chunks come before the pixels, so a stale one is not decoded
+    QImageReader cached(path);
+    if (cached.text("Thumb::URI") == uri && cached.text("Thumb::MTime") == mtime) {
+        QImage image;
+        if (cached.read(&image)) {
+            Metrics::add("thumbnails/cached");
+            return image;
+        }
+    }
+
+    QImageReader reader(fileName);
+    QSize size = reader.size();
+    if (size.isValid() && (size.width() > thumbnailSide || size.height() > thumbnailSide))
+        reader.setScaledSize(size.scaled(thumbnailSide, thumbnailSide,
+                                         Qt::KeepAspectRatio));
+    QImage image;
+    if (!reader.read(&image))
+        return QImage();
+    Metrics::add("thumbnails/made");
+
+    // written whole and renamed into place, readable by us alone
+    QString folder = QFileInfo(path).absolutePath();
+    if (QDir().mkpath(folder))
+        QFile::setPermissions(folder, QFile::ReadOwner | QFile::WriteOwner
+                              | QFile::ExeOwner);
+    image.setText("Thumb::URI", uri);
+    image.setText("Thumb::MTime", mtime);
+    image.setText("Thumb::Size", QString::number(info.size()));
+    image.setText("Software", "qt314wall");
+    QSaveFile file(path);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.setPermissions(QFile::ReadOwner | QFile::WriteOwner);
+        if (image.save(&file, "PNG"))
+            file.commit();
+    }
+    return image;
+}
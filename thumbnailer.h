@@ -0,0 +1,44 @@
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include <QImage>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+
+// Thumbnails through the freedesktop cache (~/.cache/thumbnails/normal,
+// 128px), so they are shared with file managers and made once.  Missing
+// ones are made from a decode that shrinks on the way.  Requests are served
+// newest first by a small pool, and only the latest few hundred are kept,
+// so scrolling fast through a big library only thumbnails what comes to
+// rest on screen.
+class Thumbnailer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Thumbnailer(QObject *parent = nullptr);
+    ~Thumbnailer();
+
+    void request(const QString &fileName);
+    // Forget the requests not yet started.
+    void clear();
+
+    // The cached thumbnail, made and stored first if it is missing or
+    // stale; null if the file cannot be read.
+    static QImage thumbnail(const QString &fileName);
+    static QString cachePath(const QString &uri);
+
+signals:
+    void ready(const QString &fileName, const QImage &image);
+
+private:
+    void startJobs();
+
+    QThreadPool pool;
+    QStringList pending;
+    QSet<QString> queued;
+    int running;
+};
+
+#endif // THUMBNAILER_H
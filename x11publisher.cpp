@@ -0,0 +1,168 @@
+#include "x11publisher.h"
+
+#ifdef HAVE_XCB
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+
+static xcb_atom_t internAtom(xcb_connection_t *c, const char *name,
+                             bool onlyIfExists)
+{
+    xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(c,
+            xcb_intern_atom(c, onlyIfExists, uint16_t(strlen(name)), name),
+            nullptr);
+    if (!reply)
+        return XCB_ATOM_NONE;
+    xcb_atom_t atom = reply->atom;
+    free(reply);
+    return atom;
+}
+
+static xcb_pixmap_t rootPixmap(xcb_connection_t *c, xcb_window_t root,
+                               xcb_atom_t property)
+{
+    if (property == XCB_ATOM_NONE)
+        return XCB_NONE;
+    xcb_get_property_reply_t *reply = xcb_get_property_reply(c,
+            xcb_get_property(c, 0, root, property, XCB_ATOM_PIXMAP, 0, 1),
+            nullptr);
+    if (!reply)
+        return XCB_NONE;
+    xcb_pixmap_t pixmap = XCB_NONE;
+    if (reply->type == XCB_ATOM_PIXMAP && xcb_get_property_value_length(reply) == 4)
+        pixmap = *static_cast<xcb_pixmap_t*>(xcb_get_property_value(reply));
+    free(reply);
+    return pixmap;
+}
+
+static bool hasShm(xcb_connection_t *c)
+{
+    xcb_shm_query_version_reply_t *reply = xcb_shm_query_version_reply(c,
+            xcb_shm_query_version(c), nullptr);
+    if (!reply)
+        return false;
+    free(reply);
+    return true;
+}
+
+static bool uploadShm(xcb_connection_t *c, xcb_pixmap_t pixmap,
+                      xcb_gcontext_t gc, uint8_t depth, const QImage &frame)
+{
+    size_t bytes = size_t(frame.bytesPerLine()) * size_t(frame.height());
+    int shmid = shmget(IPC_PRIVATE, bytes, IPC_CREAT | 0600);
+    if (shmid < 0)
+        return false;
+    void *data = shmat(shmid, nullptr, 0);
+    // mark it for removal now, it goes away once both sides detach
+    shmctl(shmid, IPC_RMID, nullptr);
+    if (data == reinterpret_cast<void*>(-1))
+        return false;
+    memcpy(data, frame.constBits(), bytes);
+
+    xcb_shm_seg_t seg = xcb_generate_id(c);
+    xcb_shm_attach(c, seg, uint32_t(shmid), 1);
+    xcb_void_cookie_t put = xcb_shm_put_image_checked(c, pixmap, gc,
+            uint16_t(frame.bytesPerLine() / 4), uint16_t(frame.height()),
+            0, 0, uint16_t(frame.width()), uint16_t(frame.height()), 0, 0,
+            depth, XCB_IMAGE_FORMAT_Z_PIXMAP, 0, seg, 0);
+    xcb_generic_error_t *error = xcb_request_check(c, put);
+    xcb_shm_detach(c, seg);
+    // the detach has to reach the server before the memory goes
+    free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), nullptr));
+    shmdt(data);
+    free(error);
+    return error == nullptr;
+}
+
+static void uploadPlain(xcb_connection_t *c, xcb_pixmap_t pixmap,
+                        xcb_gcontext_t gc, uint8_t depth, const QImage &frame)
+{
+    // as many rows per request as the server takes
+    uint32_t maxBytes = xcb_get_maximum_request_length(c) * 4 - 64;
+    int rows = std::max(1, int(maxBytes / uint32_t(frame.bytesPerLine())));
+    for (int y = 0; y < frame.height(); y += rows) {
+        int n = std::min(rows, frame.height() - y);
+        xcb_put_image(c, XCB_IMAGE_FORMAT_Z_PIXMAP, pixmap, gc,
+                      uint16_t(frame.width()), uint16_t(n), 0, int16_t(y), 0,
+                      depth, uint32_t(n * frame.bytesPerLine()),
+                      frame.constScanLine(y));
+    }
+}
+
+bool X11Publisher::isAvailable()
+{
+    return !qEnvironmentVariableIsEmpty("DISPLAY");
+}
+
+bool X11Publisher::publish(const QImage &image)
+{
+    if (image.isNull() || !isAvailable())
+        return false;
+    int screenNumber = 0;
+    xcb_connection_t *c = xcb_connect(nullptr, &screenNumber);
+    if (xcb_connection_has_error(c)) {
+        xcb_disconnect(c);
+        return false;
+    }
+    const xcb_setup_t *setup = xcb_get_setup(c);
+    xcb_screen_iterator_t it = xcb_setup_roots_iterator(setup);
+    for (int i = 0; i < screenNumber && it.rem; i++)
+        xcb_screen_next(&it);
+    xcb_screen_t *screen = it.data;
+    // RGB32 is what a little-endian 24 bit TrueColor visual takes as is
+    if (!screen || screen->root_depth != 24
+            || setup->image_byte_order != XCB_IMAGE_ORDER_LSB_FIRST) {
+        xcb_disconnect(c);
+        return false;
+    }
+    QImage frame = image.format() == QImage::Format_RGB32
+            ? image : image.convertToFormat(QImage::Format_RGB32);
+    xcb_window_t root = screen->root;
+
+    xcb_pixmap_t pixmap = xcb_generate_id(c);
+    xcb_create_pixmap(c, screen->root_depth, pixmap, root,
+                      uint16_t(frame.width()), uint16_t(frame.height()));
+    xcb_gcontext_t gc = xcb_generate_id(c);
+    xcb_create_gc(c, gc, pixmap, 0, nullptr);
+    if (!hasShm(c) || !uploadShm(c, pixmap, gc, screen->root_depth, frame))
+        uploadPlain(c, pixmap, gc, screen->root_depth, frame);
+    xcb_free_gc(c, gc);
+
+    // free the previous wallpaper if it was set by a well-behaved setter
+    xcb_atom_t xrootpmap = internAtom(c, "_XROOTPMAP_ID", false);
+    xcb_atom_t esetroot = internAtom(c, "ESETROOT_PMAP_ID", false);
+    xcb_pixmap_t old = rootPixmap(c, root, xrootpmap);
+    if (old != XCB_NONE && old == rootPixmap(c, root, esetroot))
+        xcb_kill_client(c, old);
+
+    xcb_change_property(c, XCB_PROP_MODE_REPLACE, root, xrootpmap,
+                        XCB_ATOM_PIXMAP, 32, 1, &pixmap);
+    xcb_change_property(c, XCB_PROP_MODE_REPLACE, root, esetroot,
+                        XCB_ATOM_PIXMAP, 32, 1, &pixmap);
+    xcb_change_window_attributes(c, root, XCB_CW_BACK_PIXMAP, &pixmap);
+    xcb_clear_area(c, 0, root, 0, 0, 0, 0);
+    // keep the pixmap once we disconnect
+    xcb_set_close_down_mode(c, XCB_CLOSE_DOWN_RETAIN_PERMANENT);
+    xcb_flush(c);
+    xcb_disconnect(c);
+    return true;
+}
+
+#else
+
+bool X11Publisher::isAvailable()
+{
+    return false;
+}
+
+bool X11Publisher::publish(const QImage &frame)
+{
+    (void)frame;
+    return false;
+}
+
+#endif
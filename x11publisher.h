@@ -0,0 +1,19 @@
+#ifndef X11PUBLISHER_H
+#define X11PUBLISHER_H
+
+#include <QImage>
+
+// Sets the X11 root window background straight from a rendered frame, the
+// way Esetroot does: the frame goes into a pixmap (through MIT-SHM when the
+// server has it), which is published in _XROOTPMAP_ID and ESETROOT_PMAP_ID
+// and kept alive after we disconnect.  The previous pixmap is freed on the
+// next change.  Only built when qmake finds xcb and xcb-shm; any display
+// the server can be reached on works, including a local Xvfb.
+namespace X11Publisher {
+
+bool isAvailable();
+bool publish(const QImage &frame);
+
+}
+
+#endif // X11PUBLISHER_H